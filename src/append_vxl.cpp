@@ -0,0 +1,215 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pointset.h"
+#include "morton.h"
+#include "parallel.h"
+#include "timing.h"
+#include "vxl_index.h"
+#include "options.h"
+
+/* Adds the points of new scans to a sorted pointset.
+ *
+ * Only the new points are sorted, in chunks on multiple threads.
+ * The sorted chunks are then merged with the existing points in a single sequential pass,
+ * such that the time needed is proportional to the size of the new scans, plus one copy of the pointset.
+ * The result is marked as sorted, such that build_db need not check or sort it, and indexed for crop.
+ */
+
+static void usage() {
+  fprintf(stderr,"Please specify the pointset and the scans to add to it (without '.vxl').\n");
+  fprintf(stderr,"Usage: append_vxl [-j threads] pointset scan...\n");
+  fprintf(stderr,"  -j Number of threads used to sort the new points (default: all processors).\n");
+  exit(2);
+}
+
+/** A point with its position along the hilbert curve. */
+struct keyed_point {
+  uint64_t key;
+  point p;
+  bool operator<(const keyed_point& k) const {return key < k.key;}
+};
+
+/** The new points, divided into chunks that are sorted separately. */
+struct sort_job {
+  std::vector<keyed_point> points;
+  uint64_t chunk;
+};
+
+static void sort_task(uint64_t i, void * data) {
+  sort_job& j = *(sort_job*)data;
+  uint64_t begin = i*j.chunk;
+  uint64_t end = std::min(begin + j.chunk, (uint64_t)j.points.size());
+  std::sort(j.points.begin()+begin, j.points.begin()+end);
+}
+
+/** Checks whether the points are sorted along the hilbert curve. */
+/** Returns whether both quantizations map input coordinates to the same points. */
+static bool same_frame(const quantization& a, const quantization& b) {
+  return a.offset[0]==b.offset[0] && a.offset[1]==b.offset[1] && a.offset[2]==b.offset[2] && a.scale==b.scale;
+}
+
+/**
+ * Adds the points of the given scan to the job.
+ * If it was quantized differently, its points are converted to the coordinates of the pointset.
+ * Points that do not fit in the pointset are skipped.
+ */
+static void load_scan(Timer& t, const char * file, const quantization * frame, sort_job& j) {
+  pointset in(file);
+  madvise(in.list, in.size, MADV_SEQUENTIAL);
+  quantization q;
+  bool convert = frame && q.read(file) && !same_frame(q, *frame);
+  if (convert) printf("[%10.0f] Converting the coordinates of '%s' to those of the pointset.\n", t.elapsed(), file);
+  uint64_t skipped = 0;
+  double limit = (1u<<(frame?frame->depth:0)) - 1;
+  for (uint64_t i=0; i<in.length; i++) {
+    keyed_point k;
+    k.p = in.list[i];
+    if (convert) {
+      double coord[3];
+      bool fits = true;
+      const uint32_t * v = &k.p.x;
+      for (int a=0; a<3; a++) {
+        coord[a] = v[a] / q.scale + q.offset[a];
+        double r = (coord[a] - frame->offset[a]) * frame->scale;
+        if (r < -0.5 || r >= limit + 0.5) fits = false;
+      }
+      if (!fits) {
+        skipped++;
+        continue;
+      }
+      k.p = frame->apply(coord, k.p.c);
+    }
+    k.key = hilbert3d(k.p);
+    j.points.push_back(k);
+  }
+  printf("[%10.0f] Read %lu points from '%s'.\n", t.elapsed(), in.length - skipped, file);
+  if (skipped) printf("[%10.0f] Skipped %lu points that lie outside of the pointset.\n", t.elapsed(), skipped);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  int threads = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    switch (opt) {
+      case 'j': threads = parse_int(optarg, "number of threads"); break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc < 3) usage();
+  if (threads<=0) threads = processor_count();
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char outfile[length+9];
+  char tmpfile[length+13];
+  sprintf(outfile, "vxl/%s.vxl", name);
+  sprintf(tmpfile, "vxl/%s.vxl.tmp", name);
+  bool exists = !access(outfile, F_OK);
+  quantization frame;
+  bool has_frame = exists && frame.read(outfile);
+
+  // Read and sort the new points.
+  sort_job j;
+  for (int i=2; i<argc; i++) {
+    char scanfile[strlen(argv[i])+10];
+    sprintf(scanfile, "vxl/%s.vxl", argv[i]);
+    if (access(scanfile, F_OK)) sprintf(scanfile, "vxl/%s.vxlz", argv[i]);
+    if (!exists && !has_frame && frame.read(scanfile)) {
+      // The pointset is created using the coordinates of the first scan.
+      frame.write(outfile);
+      has_frame = true;
+    }
+    load_scan(t, scanfile, has_frame ? &frame : NULL, j);
+  }
+  printf("[%10.0f] Sorting %lu new points.\n", t.elapsed(), j.points.size());
+  uint64_t chunks = std::min((uint64_t)threads, (uint64_t)j.points.size()/65536+1);
+  j.chunk = (j.points.size() + chunks - 1) / chunks;
+  parallel_for(threads, chunks, sort_task, &j);
+
+  // Merge the sorted chunks with the points that are already in the pointset.
+  uint64_t total = j.points.size();
+  vxl_index index;
+  index.stride = VXL_INDEX_STRIDE;
+  {
+    pointset * in = NULL;
+    const point * list = NULL;
+    uint64_t count = 0;
+    if (exists) {
+      in = new pointset(outfile);
+      madvise(in->list, in->size, MADV_SEQUENTIAL);
+      if (is_sorted(outfile, in->length)) {
+        printf("[%10.0f] '%s' is marked as sorted.\n", t.elapsed(), outfile);
+      } else if (!check_sorted(t, *in)) {
+        fprintf(stderr, "'%s' is not sorted, sort it by running build_db first.\n", outfile);
+        exit(1);
+      }
+      list = in->list;
+      count = in->length;
+    }
+    total += count;
+    printf("[%10.0f] Merging %lu new points with %lu points into '%s'.\n", t.elapsed(), j.points.size(), count, tmpfile);
+    pointfile out(tmpfile);
+    // Each entry holds the key of the next point of a run, where run 0 is the existing pointset.
+    // Hence existing points precede new points with the same key.
+    typedef std::pair<uint64_t, uint64_t> head;
+    std::priority_queue<head, std::vector<head>, std::greater<head> > queue;
+    std::vector<uint64_t> next(chunks+1), end(chunks+1);
+    end[0] = count;
+    if (count) queue.push(head(hilbert3d(list[0]), 0));
+    for (uint64_t c=0; c<chunks; c++) {
+      next[c+1] = c*j.chunk;
+      end[c+1] = std::min(next[c+1] + j.chunk, (uint64_t)j.points.size());
+      if (next[c+1] < end[c+1]) queue.push(head(j.points[next[c+1]].key, c+1));
+    }
+    for (uint64_t i=0; !queue.empty(); i++) {
+      if (i && (i&0x3fffff)==0) printf("[%10.0f] Merging ... %6.2f%%.\n", t.elapsed(), i*100.0/total);
+      uint64_t r = queue.top().second;
+      if (i % index.stride == 0) index.keys.push_back(queue.top().first);
+      queue.pop();
+      if (r == 0) {
+        out.add(list[next[0]]);
+        if (++next[0] < end[0]) queue.push(head(hilbert3d(list[next[0]]), 0));
+      } else {
+        out.add(j.points[next[r]].p);
+        if (++next[r] < end[r]) queue.push(head(j.points[next[r]].key, r));
+      }
+    }
+    delete in;
+  }
+  if (rename(tmpfile, outfile)) {perror("Could not replace pointset"); exit(1);}
+  mark_sorted(outfile, true, total);
+  index.points = total;
+  index.write(outfile);
+  printf("[%10.0f] Wrote %lu points to '%s'.\n", t.elapsed(), total, outfile);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,72 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cassert>
+#include <png.h>
+
+#include "art.h"
+
+/* Renders to a buffer in memory instead of a window, 
+ * such that the renderer can be benchmarked on machines without a display.
+ */
+
+namespace {
+    // The pixels (32 bit)
+    int pixs[SCREEN_WIDTH*SCREEN_HEIGHT];
+}
+
+void init_screen(const char * caption) {
+    (void)caption;
+}
+
+void clear_creen() {
+    for (int i=0; i<SCREEN_WIDTH*SCREEN_HEIGHT; i++) pixs[i] = 0xaaccff;
+}
+
+void flip_screen() {
+}
+
+void pixel(uint32_t x, uint32_t y, uint32_t c) {
+    assert(x<SCREEN_WIDTH && y<SCREEN_HEIGHT);
+    int64_t i = x+y*(SCREEN_WIDTH);
+    pixs[i] = c;
+}
+
+void export_png(const char * out) {
+    static int rgba[SCREEN_WIDTH*SCREEN_HEIGHT];
+    png_bytep row_pointers[SCREEN_HEIGHT];
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    FILE * fp = NULL;
+    if (png_ptr && info_ptr && !setjmp(png_jmpbuf(png_ptr))) {
+        for (int i=0; i<SCREEN_WIDTH*SCREEN_HEIGHT; i++)
+            rgba[i] = 0xff000000 | ((pixs[i]&0xff0000)>>16) | (pixs[i]&0xff00) | ((pixs[i]&0xff)<<16);
+        fp = fopen(out,"wb");
+        if (!fp) {perror("Could not create image"); png_destroy_write_struct(&png_ptr, &info_ptr); return;}
+        png_init_io (png_ptr, fp);
+        png_set_IHDR(png_ptr, info_ptr, SCREEN_WIDTH, SCREEN_HEIGHT, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        for (int i = 0; i < SCREEN_HEIGHT; i++) row_pointers[i] = (png_bytep)(rgba+i*SCREEN_WIDTH);
+        png_set_rows(png_ptr, info_ptr, row_pointers);
+        png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, 0);
+    }
+    if (fp) fclose(fp);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle; 
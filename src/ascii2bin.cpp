@@ -22,17 +22,40 @@
 #include <unistd.h>
 
 #include "pointset.h"
+#include "textfile.h"
+#include "parallel.h"
+#include "voxel_grid.h"
 
 /* Accepts files with lines of the format:
  * x y z color
  * And converts them to binary format.
  */
 
+static bool parse(text_cursor& line, point& p, void *) {
+  if (!line.read_uint(p.x) || !line.read_uint(p.y) || !line.read_uint(p.z) || !line.read_hex(p.c)) return false;
+  p.c = ((p.c&0xff)<<16)|(p.c&0xff00)|((p.c&0xff0000)>>16);
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr,"Please specify the file to convert (without '.txt').\n");
+  fprintf(stderr,"Usage: ascii2bin [-m] file\n");
+  fprintf(stderr,"  -m Merge the points with equal coordinates into one point with their average color.\n");
+  exit(2);
+}
+
 int main(int argc, char ** argv) {
-  if (argc != 2) {
-    fprintf(stderr,"Please specify the file to convert (without '.txt').\n");
-    exit(2);
+  bool merge = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "m")) != -1) {
+    switch (opt) {
+      case 'm': merge = true; break;
+      default: usage();
+    }
   }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2) usage();
 
   // Determine the file names.
   char * name = argv[1];
@@ -51,26 +74,17 @@ int main(int argc, char ** argv) {
   }
   
   // Open the files.
-  FILE * res;
-  res = freopen( infile,  "r", stdin );
-  if (res==NULL) {
-    fprintf(stderr,"Failed to open '%s' for input.\n", infile);
-    exit(2);
-  }
+  textfile in(infile);
   pointfile out(outfile);
 
   // Do the conversion
-  point p;
-  int line=0;
-  for(;;) {
-    if(line%(1<<20)==0) fprintf(stderr,"line: %3dMi\n", line>>20);
-    int ret = scanf("%u %u %u %x\n", &p.x, &p.y, &p.z, &p.c);
-    if (ret < 4) break;
-    p.c = ((p.c&0xff)<<16)|(p.c&0xff00)|((p.c&0xff0000)>>16);
-    out.add(p);
-    line++;
+  voxel_grid grid;
+  text_stats stats = in.parse_points(0, processor_count(), parse, NULL, out, merge ? &grid : NULL);
+  if (merge) {
+    fprintf(stderr,"voxels: %lu\n", grid.size());
+    grid.write(out, processor_count());
   }
-  fprintf(stderr,"lines: %d\n", line);
+  fprintf(stderr,"lines: %lu, points: %lu\n", stats.lines, stats.points);
 }
 
 // kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,124 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "baseline.h"
+
+bool baseline::read(const char * filename) {
+    entries.clear();
+    FILE * f = fopen(filename, "r");
+    if (!f) return false;
+    char scene[256];
+    entry e;
+    int n;
+    while (fscanf(f, "%255s %d %d %d %d %d", scene, &e.pose, &e.width, &e.height, &e.threads, &n) == 6) {
+        e.scene = scene;
+        e.times.resize(n < 0 ? 0 : n);
+        for (int i=0; i<n; i++) {
+            if (fscanf(f, "%lf", &e.times[i]) != 1) n = -1;
+        }
+        if (n < 0) break;
+        entries.push_back(e);
+    }
+    bool ok = feof(f);
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Could not parse baseline '%s'.\n", filename);
+        exit(1);
+    }
+    return true;
+}
+
+void baseline::write(const char * filename) const {
+    FILE * f = fopen(filename, "w");
+    if (!f) {perror("Could not create baseline"); exit(1);}
+    for (size_t i=0; i<entries.size(); i++) {
+        const entry& e = entries[i];
+        fprintf(f, "%s %d %d %d %d %lu", e.scene.c_str(), e.pose, e.width, e.height, e.threads, e.times.size());
+        for (size_t j=0; j<e.times.size(); j++) fprintf(f, " %.3f", e.times[j]);
+        fprintf(f, "\n");
+    }
+    bool ok = !ferror(f);
+    if (fclose(f)) ok = false;
+    if (!ok) {perror("Could not write baseline"); exit(1);}
+}
+
+const baseline::entry * baseline::find(const char * scene, int pose, int width, int height, int threads) const {
+    for (size_t i=0; i<entries.size(); i++) {
+        const entry& e = entries[i];
+        if (e.scene == scene && e.pose == pose && e.width == width && e.height == height && e.threads == threads) return &e;
+    }
+    return NULL;
+}
+
+void baseline::set(const char * scene, int pose, int width, int height, int threads, const std::vector<double>& times) {
+    for (size_t i=0; i<entries.size(); i++) {
+        entry& e = entries[i];
+        if (e.scene == scene && e.pose == pose && e.width == width && e.height == height && e.threads == threads) {
+            e.times = times;
+            return;
+        }
+    }
+    entry e;
+    e.scene = scene;
+    e.pose = pose;
+    e.width = width;
+    e.height = height;
+    e.threads = threads;
+    e.times = times;
+    entries.push_back(e);
+}
+
+/**
+ * The samples are ranked together, with tied samples getting their average rank.
+ * The statistic U of a is compared to its mean n_a*n_b/2, with a continuity correction of 0.5.
+ */
+double mann_whitney(const std::vector<double>& a, const std::vector<double>& b) {
+    double na = a.size(), nb = b.size(), n = na + nb;
+    if (a.empty() || b.empty()) return 1;
+    std::vector<std::pair<double, int> > all;
+    for (size_t i=0; i<a.size(); i++) all.push_back(std::make_pair(a[i], 0));
+    for (size_t i=0; i<b.size(); i++) all.push_back(std::make_pair(b[i], 1));
+    std::sort(all.begin(), all.end());
+    double rank_sum = 0; // Sum of the ranks of a.
+    double ties = 0; // Sum of t^3-t over groups of t tied samples.
+    for (size_t i=0; i<all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first) j++;
+        double rank = (i + 1 + j) / 2.0; // Average of the ranks i+1 ... j.
+        for (size_t k=i; k<j; k++) {
+            if (all[k].second == 0) rank_sum += rank;
+        }
+        double t = j - i;
+        ties += t*t*t - t;
+        i = j;
+    }
+    double u = rank_sum - na*(na+1)/2;
+    double mean = na*nb/2;
+    double variance = na*nb/12 * ((n+1) - ties/(n*(n-1)));
+    if (variance <= 0) return 1;
+    double z = (u - mean - 0.5) / sqrt(variance);
+    return 0.5 * erfc(z / sqrt(2.0));
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
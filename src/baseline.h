@@ -0,0 +1,56 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BASELINE_H
+#define BASELINE_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Stores the frame times of benchmark runs, such that later runs can be compared against them.
+ * 
+ * The results are keyed by scene, pose, resolution and number of threads, 
+ * such that a single file can hold the baselines of different scenes and configurations.
+ * The file contains one line per key: 'scene pose width height threads n t1 ... tn', with the n frame times in milliseconds.
+ */
+struct baseline {
+    struct entry {
+        std::string scene;
+        int pose, width, height, threads;
+        std::vector<double> times;
+    };
+    std::vector<entry> entries;
+    /** Reads the given file. Returns false if it does not exist. Exits if it is malformed. */
+    bool read(const char * filename);
+    /** Writes the given file. Exits if this fails. */
+    void write(const char * filename) const;
+    /** Returns the entry with the given key, or NULL if there is none. */
+    const entry * find(const char * scene, int pose, int width, int height, int threads) const;
+    /** Stores the frame times for the given key, replacing those that were stored before. */
+    void set(const char * scene, int pose, int width, int height, int threads, const std::vector<double>& times);
+};
+
+/**
+ * Performs a one-sided Mann-Whitney U test, using the normal approximation with a correction for ties.
+ * Returns the probability of samples a being at least as much larger than samples b as observed, 
+ * if both come from the same distribution. 
+ */
+double mann_whitney(const std::vector<double>& a, const std::vector<double>& b);
+
+#endif
@@ -19,22 +19,36 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
-#include <cassert>
-#include <algorithm>
 #include <cstring>
-
-#include <map>
-#include <string>
-
-#include <png.h>
+#include <cerrno>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "timing.h"
 #include "events.h"
 #include "art.h"
 #include "octree.h"
+#include "baseline.h"
+#include "options.h"
 
 using namespace std;
 
+/* Renders a set of scenes from fixed camera poses and measures the frame times.
+ * 
+ * The frames are rendered to memory, such that the benchmark runs on machines without a display.
+ * Each pose is rendered a number of times for warming up, followed by the timed frames.
+ * In cold mode, the octree file is evicted from the page cache before each timed frame,
+ * such that the frame includes reading the nodes it needs from storage.
+ * 
+ * The frame times can be stored as a baseline, and compared against the baseline in later runs.
+ * A pose has regressed if its frame times are significantly larger according to a Mann-Whitney U test, 
+ * and its median frame time increased by more than a threshold.
+ */
+
 struct Scene {
     const char * filename;
     glm::dvec3 position;
@@ -43,6 +57,9 @@ struct Scene {
 
 static const int32_t SCENE_DEPTH = 26;
 static const double SCALE = 1<<SCENE_DEPTH;
+static const int THREADS = 1; /// The renderer uses a single thread.
+static const double ALPHA = 0.05; /// Significance level of the comparison with the baseline.
+static const int REGRESSED = 3; /// Exit status if a pose regressed.
 
 static const Scene scene [] = {
     {"sibenik",  glm::dvec3( 0.0000,  0.0000,  0.0000),  glm::dmat3(-0.119, -0.430, -0.895,   0.249,  0.860, -0.446,   0.961, -0.275,  0.005)},
@@ -63,71 +80,311 @@ static const Scene scene [] = {
 };
 
 static const int scenes = sizeof(scene)/sizeof(scene[0]);
-static const int N = 5;
-double results[scenes];
+
+/** Camera poses for scenes without poses of their own: inside at the center and outside at a corner, looking at the center. */
+static const Scene default_scene [] = {
+    {NULL,       glm::dvec3( 0.0000,  0.0000,  0.0000),  glm::dmat3( 1.000,  0.000,  0.000,   0.000,  1.000,  0.000,   0.000,  0.000,  1.000)},
+    {NULL,       glm::dvec3(-1.5000, -1.2000, -1.5000),  glm::dmat3( 0.707, -0.348,  0.616,   0.000,  0.870,  0.492,  -0.707, -0.348,  0.616)},
+};
+
+static const int default_scenes = sizeof(default_scene)/sizeof(default_scene[0]);
+
+/** A pose of a scene that is measured. */
+struct measurement {
+    const char * name;
+    int pose; /// Index of the pose among the poses of the scene.
+    const Scene * scene;
+    uint64_t octree_bytes;
+    uint64_t cold_resident_bytes; /// Bytes of the octree that were still cached after evicting it, summed over the frames.
+    uint64_t resident_bytes; /// Bytes of the octree that were cached after the last frame.
+    vector<double> times;
+    vector<draw_stats> frames;
+    bool compared; /// Whether a baseline exists for this pose.
+    double baseline_p50;
+    double p_value; /// Probability of frame times that are this much slower than the baseline by chance.
+    bool regressed;
+    measurement() : name(NULL), pose(0), scene(NULL), octree_bytes(0), cold_resident_bytes(0), resident_bytes(0), 
+        compared(false), baseline_p50(0), p_value(1), regressed(false) {}
+};
+
+static void usage() {
+    fprintf(stderr,"Usage: benchmark [-n iterations] [-w warmup] [-c] [-o report.json] [-p prefix] [-b baseline [-t percent]] [-s baseline] [scene...]\n");
+    fprintf(stderr,"  Renders the poses of the given scenes 'vxl/scene.oct', or of all scenes if none is given.\n");
+    fprintf(stderr,"  -n Number of timed frames per pose (default: 10).\n");
+    fprintf(stderr,"  -w Number of frames rendered before the timed frames (default: 1).\n");
+    fprintf(stderr,"  -c Evict the octree from the page cache before each timed frame.\n");
+    fprintf(stderr,"  -o Write the frame times and traversal counters to the given JSON file.\n");
+    fprintf(stderr,"  -p Write the last frame of each pose to 'bshots/prefix-##-scene.png'.\n");
+    fprintf(stderr,"  -b Compare the frame times with those stored in the given baseline file.\n");
+    fprintf(stderr,"  -t Median increase in percent above which a significant difference is a regression (default: 5).\n");
+    fprintf(stderr,"  -s Store the frame times in the given baseline file, replacing those of the same poses, unless a pose regressed.\n");
+    fprintf(stderr,"  The exit status is %d if a pose regressed.\n", REGRESSED);
+    exit(2);
+}
+
+/** 
+ * Evicts the given file from the page cache. 
+ * Pages that are mapped are not evicted, hence the file must not be mapped.
+ */
+static void drop_cache(const char * filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {perror("Could not open file"); exit(1);}
+    int ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (ret) {errno = ret; perror("Could not evict file from page cache"); exit(1);}
+    close(fd);
+}
+
+/** Returns the number of bytes of the octree that are in the page cache. */
+static uint64_t resident_bytes(const octree_file& in) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    vector<unsigned char> resident((in.size + page - 1) / page);
+    void * data = in.wide ? (void*)in.root64 : (void*)in.root;
+    if (mincore(data, in.size, resident.data())) return 0;
+    uint64_t n = 0;
+    for (uint64_t i=0; i<resident.size(); i++) n += resident[i]&1;
+    return min(n * page, in.size);
+}
+
+/** Returns the p-th percentile of the sorted samples, using the nearest rank. */
+static double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    uint64_t rank = (uint64_t)ceil(p/100 * sorted.size());
+    return sorted[rank ? rank-1 : 0];
+}
+
+static double median(const vector<double>& times) {
+    vector<double> sorted(times);
+    sort(sorted.begin(), sorted.end());
+    return percentile(sorted, 50);
+}
+
+/** Compares the results with the baseline. Returns the number of poses that regressed. */
+static int compare(const char * filename, vector<measurement>& results, double threshold) {
+    baseline base;
+    if (!base.read(filename)) {
+        fprintf(stderr, "Could not open baseline '%s'.\n", filename);
+        exit(1);
+    }
+    printf("\nComparison with baseline '%s':\n", filename);
+    int regressions = 0;
+    for (uint64_t i=0; i<results.size(); i++) {
+        measurement& m = results[i];
+        const baseline::entry * e = base.find(m.name, m.pose, SCREEN_WIDTH, SCREEN_HEIGHT, THREADS);
+        if (!e || e->times.empty()) {
+            printf("Test %2lu: %-10s %d | no baseline\n", i, m.name, m.pose);
+            continue;
+        }
+        double p50 = median(m.times);
+        m.compared = true;
+        m.baseline_p50 = median(e->times);
+        m.p_value = mann_whitney(m.times, e->times);
+        m.regressed = m.p_value < ALPHA && p50 > m.baseline_p50 * (1 + threshold/100);
+        regressions += m.regressed;
+        printf("Test %2lu: %-10s %d | p50 %8.2f -> %8.2f (%+6.1f%%)  p %.4f | %s\n", i, m.name, m.pose, m.baseline_p50, p50, 
+               m.baseline_p50>0 ? (p50/m.baseline_p50-1)*100 : 0.0, m.p_value, m.regressed ? "REGRESSED" : "ok");
+    }
+    return regressions;
+}
+
+/** Stores the frame times of the results in the baseline file, keeping those of other poses. */
+static void store(const char * filename, const vector<measurement>& results) {
+    baseline base;
+    base.read(filename);
+    for (uint64_t i=0; i<results.size(); i++) {
+        base.set(results[i].name, results[i].pose, SCREEN_WIDTH, SCREEN_HEIGHT, THREADS, results[i].times);
+    }
+    base.write(filename);
+    printf("Stored the frame times of %lu poses in baseline '%s'.\n", results.size(), filename);
+}
+
+static double draw(octree_file * in, draw_stats * stats) {
+    Timer t;
+    clear_creen();
+    octree_draw(in, stats);
+    flip_screen();
+    return t.elapsed();
+}
+
+static void write_report(const char * filename, const vector<measurement>& results, int iterations, int warmup, bool cold) {
+    FILE * f = fopen(filename, "w");
+    if (!f) {perror("Could not open report file"); exit(1);}
+    rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    fprintf(f, "{\n  \"mode\": \"%s\",\n  \"iterations\": %d,\n  \"warmup\": %d,\n", cold ? "cold" : "warm", iterations, warmup);
+    fprintf(f, "  \"width\": %d,\n  \"height\": %d,\n  \"threads\": %d,\n", SCREEN_WIDTH, SCREEN_HEIGHT, THREADS);
+    fprintf(f, "  \"peak_rss_bytes\": %lu,\n  \"scenes\": [", r.ru_maxrss * 1024ul);
+    for (uint64_t i=0; i<results.size(); i++) {
+        const measurement& m = results[i];
+        vector<double> sorted(m.times);
+        sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (uint64_t j=0; j<sorted.size(); j++) sum += sorted[j];
+        fprintf(f, "%s\n    {\"scene\": \"%s\", \"pose\": %d, \"width\": %d, \"height\": %d, \"threads\": %d, ", i?",":"", m.name, m.pose, SCREEN_WIDTH, SCREEN_HEIGHT, THREADS);
+        fprintf(f, "\"octree_bytes\": %lu, \"resident_bytes\": %lu, ", m.octree_bytes, m.resident_bytes);
+        if (cold) fprintf(f, "\"cold_resident_bytes\": %lu, ", m.cold_resident_bytes);
+        if (m.compared) fprintf(f, "\n     \"baseline\": {\"p50\": %.3f, \"p_value\": %.6f, \"regressed\": %s},", m.baseline_p50, m.p_value, m.regressed ? "true" : "false");
+        fprintf(f, "\n     \"frame_ms\": {\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},", 
+                sorted.empty() ? 0 : sorted.front(), sorted.empty() ? 0 : sum/sorted.size(), 
+                percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99), sorted.empty() ? 0 : sorted.back());
+        fprintf(f, "\n     \"frames\": [");
+        for (uint64_t j=0; j<m.frames.size(); j++) {
+            const draw_stats& s = m.frames[j];
+            fprintf(f, "%s\n       {\"ms\": %.3f, \"prepare_ms\": %.3f, \"query_ms\": %.3f, \"traverse\": %lu, \"octree_nodes\": %lu, \"quadtree_nodes\": %lu}", 
+                    j?",":"", m.times[j], s.prepare, s.query, s.count, s.count_oct, s.count_quad);
+        }
+        fprintf(f, "\n     ]}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+    bool ok = !ferror(f);
+    if (fclose(f)) ok = false;
+    if (!ok) {perror("Could not write report file"); exit(1);}
+}
+
+// The benchmark does not handle events, hence defines the camera itself.
+glm::dmat3 orientation;
+glm::dvec3 position;
+
 ///////////////////////////////////////////////////////////////////////////////
 int main(int argc, char ** argv) {
-    init_screen("Voxel renderer - benchmark");
+    int iterations = 10;
+    int warmup = 1;
+    bool cold = false;
+    const char * report_file = NULL;
+    const char * prefix = NULL;
+    const char * compare_file = NULL;
+    const char * store_file = NULL;
+    double threshold = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:co:p:b:t:s:")) != -1) {
+        switch (opt) {
+            case 'n': 
+                iterations = parse_int(optarg, "number of iterations"); 
+                if (iterations<=0) usage();
+                break;
+            case 'w': 
+                warmup = parse_int(optarg, "number of warm-up iterations"); 
+                if (warmup<0) usage();
+                break;
+            case 'c': cold = true; break;
+            case 'o': report_file = optarg; break;
+            case 'p': prefix = optarg; break;
+            case 'b': compare_file = optarg; break;
+            case 's': store_file = optarg; break;
+            case 't': 
+                threshold = parse_double(optarg, "threshold"); 
+                if (threshold<0) usage();
+                break;
+            default: usage();
+        }
+    }
+    argc -= optind-1;
+    argv += optind-1;
+    if (compare_file && access(compare_file, R_OK)) {
+        fprintf(stderr, "Could not open baseline '%s'.\n", compare_file);
+        exit(1);
+    }
     
-    // mainloop
+    // Determine the poses to render.
+    vector<measurement> poses;
     for (int i=0; i<scenes; i++) {
-        // Check for quit
-        handle_events();
-        if (quit) return 1;
+        bool selected = argc == 1;
+        for (int k=1; k<argc; k++) selected |= !strcmp(argv[k], scene[i].filename);
+        if (!selected) continue;
+        measurement m;
+        m.name = scene[i].filename;
+        m.pose = poses.empty() || strcmp(poses.back().name, m.name) ? 0 : poses.back().pose+1;
+        m.scene = &scene[i];
+        poses.push_back(m);
+    }
+    for (int k=1; k<argc; k++) {
+        bool known = false;
+        for (int i=0; i<scenes; i++) known |= !strcmp(argv[k], scene[i].filename);
+        for (int i=0; i<default_scenes && !known; i++) {
+            measurement m;
+            m.name = argv[k];
+            m.pose = i;
+            m.scene = &default_scene[i];
+            poses.push_back(m);
+        }
+    }
+    
+    init_screen("Voxel renderer - benchmark");
+    vector<measurement> results;
+    for (uint64_t i=0; i<poses.size(); i++) {
+        measurement& m = poses[i];
         
-        // Load file
-        char infile[32];
-        sprintf(infile, "vxl/%s.oct", scene[i].filename);
-        octree_file in(infile);
+        // Determine the file name.
+        char infile[strlen(m.name)+11];
+        sprintf(infile, "vxl/%s.oct", m.name);
+        if (access(infile, F_OK)) sprintf(infile, "vxl/%s.oct64", m.name);
+        if (access(infile, F_OK)) {
+            if (i==0 || strcmp(poses[i-1].name, m.name)) fprintf(stderr, "Skipping scene '%s', as 'vxl/%s.oct' does not exist.\n", m.name, m.name);
+            continue;
+        }
         
         // Set camera
-        position = scene[i].position * SCALE;
-        orientation = scene[i].orientation;
+        position = m.scene->position * SCALE;
+        orientation = m.scene->orientation;
         
         // Run tests
-        double times[N];
-        for (int j=-1; j<N; j++) {
-            Timer t;
-            clear_creen();
-            octree_draw(&in);
-            flip_screen();
-            if (j>=0) {
-                times[j] = t.elapsed();
-                next_frame(times[j]);
+        octree_file * in = new octree_file(infile);
+        m.octree_bytes = in->size;
+        for (int j=0; j<warmup; j++) {
+            draw_stats stats;
+            draw(in, &stats);
+        }
+        for (int j=0; j<iterations; j++) {
+            if (cold) {
+                delete in;
+                drop_cache(infile);
+                in = new octree_file(infile);
+                m.cold_resident_bytes += resident_bytes(*in);
             }
+            draw_stats stats;
+            m.times.push_back(draw(in, &stats));
+            m.frames.push_back(stats);
         }
+        m.resident_bytes = resident_bytes(*in);
+        delete in;
         
         // Print results
-        printf("Test %2d:", i);
-        for (int j=0; j<N; j++) {
-            printf(" %7.2f", times[j]);
-        }
-        
-        // Compute average
-        std::sort(times,times+N);
-        results[i]=0;
-        for (int j=1; j<N-1; j++) {
-            results[i] += times[j];
-        }
-        results[i] /= N-2;
-        printf(" | %7.2f\n", results[i]);
+        vector<double> sorted(m.times);
+        sort(sorted.begin(), sorted.end());
+        printf("Test %2lu: %-10s %d | p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f | Count:%10lu Oct:%10lu Quad:%10lu\n", 
+               results.size(), m.name, m.pose, percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99), sorted.back(), 
+               m.frames.back().count, m.frames.back().count_oct, m.frames.back().count_quad);
         fflush(stdout);
         
         // Output png
-        if (argc>=2) {
-            char outfile[64];
-            sprintf(outfile, "bshots/%.10s-%02d-%s.png", argv[1], i, scene[i].filename);
+        if (prefix) {
+            char outfile[strlen(prefix)+strlen(m.name)+32];
+            sprintf(outfile, "bshots/%s-%02lu-%s.png", prefix, results.size(), m.name);
             export_png(outfile);
         }
+        results.push_back(m);
+    }
+    if (results.empty()) {
+        fprintf(stderr, "No scenes were rendered.\n");
+        exit(1);
     }
 
-    printf("\nBenchmark results:");
+    printf("\nBenchmark results (p50):");
     double sum = 0;
-    for (int i=0; i<scenes; i++) {
-        printf(" %7.2f", results[i]);
-        sum += results[i];
+    for (uint64_t i=0; i<results.size(); i++) {
+        vector<double> sorted(results[i].times);
+        sort(sorted.begin(), sorted.end());
+        printf(" %7.2f", percentile(sorted, 50));
+        sum += percentile(sorted, 50);
+    }
+    printf(" | %7.2f\n", sum/results.size());
+    int regressions = compare_file ? compare(compare_file, results, threshold) : 0;
+    if (report_file) write_report(report_file, results, iterations, warmup, cold);
+    if (regressions) {
+        printf("%d of %lu poses regressed.\n", regressions, results.size());
+        if (store_file) printf("Baseline '%s' is not updated.\n", store_file);
+        return REGRESSED;
     }
-    printf(" | %7.2f\n", sum/scenes);
+    if (store_file) store(store_file, results);
     return 0;
 }
 
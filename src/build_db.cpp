@@ -21,236 +21,555 @@
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <vector>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
-#include <errno.h>
+#include <pthread.h>
 
 #include "pointset.h"
 #include "timing.h"
 #include "octree.h"
+#include "morton.h"
+#include "parallel.h"
+#include "report.h"
+#include "vxl_index.h"
+#include "vxlz.h"
+#include "options.h"
 
-/** Maximum allowed depth of octree
- * Note that the sorting procedure has a bound of 21 layers.
- */
-static const int D = 21;
-
-static const uint64_t B[] = {
-  0xFFFF00000000FFFF, 
-  0x00FF0000FF0000FF, 
-  0xF00F00F00F00F00F, 
-  0x30C30C30C30C30C3, 
-  0x9249249249249249,
-};
-static const uint64_t S[] = {32, 16, 8, 4, 2};
-    
-uint64_t morton3d( uint64_t x, uint64_t y, uint64_t z ) {   
-  // pack 3 32-bit indices into a 96-bit Morton code
-  // except that the result is truncated to 64-bit.
-  for (uint64_t i=0; i<5; i++) {
-    x = (x | (x << S[i])) & B[i];
-    y = (y | (y << S[i])) & B[i];
-    z = (z | (z << S[i])) & B[i];
-  }
-  return x | (y<<1) | (z<<2);
+/** Resource usage of the build stages. */
+static report stats;
+
+template<class Node> uint32_t average(Node* root, typename Node::index index) {
+  for (int i=0; i<8; i++) {
+    if(~root[index].child[i]) {
+      root[index].avgcolor[i] = average(root, root[index].child[i]);
+    }
+  }
+  return average(root[index]);
 }
 
-uint64_t hilbert3d( const point & p ) {
-  uint64_t val = morton3d( p.x,p.y,p.z );
-  uint64_t start = 0;
-  uint64_t end = 1; // can be 1,2,4
-  uint64_t ret = 0;
-  for (int64_t j=19; j>=0; j--) {
-    uint64_t rg = ((val>>(3*j))&7) ^ start;
-    uint64_t travel_shift = (0x30210 >> (start ^ end)*4)&3;
-    uint64_t i = (((rg << 3) | rg) >> travel_shift ) & 7;
-    i = (0x54672310 >> i*4) & 7;
-    ret = (ret<<3) | i;
-    uint64_t si = (0x64422000 >> i*4 ) & 7; // next lower even number, or 0
-    uint64_t ei = (0x77755331 >> i*4 ) & 7; // next higher odd number, or 7
-    uint64_t sg = ( si ^ (si>>1) ) << travel_shift;
-    uint64_t eg = ( ei ^ (ei>>1) ) << travel_shift;
-    end   = ( ( eg | ( eg >> 3 ) ) & 7 ) ^ start;
-    start = ( ( sg | ( sg >> 3 ) ) & 7 ) ^ start;
-  }
-  return ret;
+/** Replaces the children outside the mask by copies of those inside the mask. */
+template<class Node> void replicate(Node& n, uint32_t mask) {
+    for (uint32_t i=0; i<8; i++) {
+        if (i != (i&mask)) {
+            n.child[i] = n.child[i&mask];
+            n.avgcolor[i] = n.avgcolor[i&mask];
+        }
+    }
 }
-    
-bool hilbert3d_compare( const point & p1,const point & p2 ) {
-  uint64_t val1 = morton3d( p1.x,p1.y,p1.z );
-  uint64_t val2 = morton3d( p2.x,p2.y,p2.z );
-  uint64_t start = 0;
-  uint64_t end = 1; // can be 1,2,4
-  for (int64_t j=19; j>=0; j--) {
-    uint64_t travel_shift = (0x30210 >> (start ^ end)*4)&3;
-    uint64_t rg1 = ((val1>>(3*j))&7) ^ start;
-    uint64_t rg2 = ((val2>>(3*j))&7) ^ start;
-    uint64_t i1 = (((rg1 << 3) | rg1) >> travel_shift ) & 7;
-    uint64_t i2 = (((rg2 << 3) | rg2) >> travel_shift ) & 7;
-    i1 = (0x54672310 >> i1*4) & 7;
-    i2 = (0x54672310 >> i2*4) & 7;
-    if (i1<i2) return true;
-    if (i1>i2) return false;
-    uint64_t si = (0x64422000 >> i1*4 ) & 7; // next lower even number, or 0
-    uint64_t ei = (0x77755331 >> i1*4 ) & 7; // next higher odd number, or 7
-    uint64_t sg = ( si ^ (si>>1) ) << travel_shift;
-    uint64_t eg = ( ei ^ (ei>>1) ) << travel_shift;
-    end   = ( ( eg | ( eg >> 3 ) ) & 7 ) ^ start;
-    start = ( ( sg | ( sg >> 3 ) ) & 7 ) ^ start;
-  }
-  return false;
+
+template<class Node> void replicate(Node* root, typename Node::index index, uint32_t mask, uint32_t depth) {
+    if (depth<=0) return;
+    for (uint32_t i=0; i<8; i++) {
+        if (i == (i&mask) && ~root[index].child[i]) replicate(root, root[index].child[i], mask, depth-1);
+    }
+    replicate(root[index], mask);
 }
 
-#define CLAMP(x,l,u) (x<l?l:x>u?u:x)
-uint32_t rgb(int32_t r, int32_t g, int32_t b) {
-  return CLAMP(r,0,255)<<16|CLAMP(g,0,255)<<8|CLAMP(b,0,255);
+/** Points to build an octree from, which are either in memory or decompressed block by block. */
+struct point_source {
+  const point * list;
+  uint64_t length;
+  const vxlz_reader * reader;
+  point_source(const point * list, uint64_t length) : list(list), length(length), reader(NULL) {}
+  point_source(const vxlz_reader& reader) : list(NULL), length(reader.length), reader(&reader) {}
+  uint64_t blocks() const {return reader ? reader->index.size() : 1;}
+  /** Returns the given block and its number of points, decompressing it into the buffer if needed. */
+  const point * block(uint64_t b, std::vector<point>& buffer, uint64_t& n) const {
+    if (!reader) {
+      n = length;
+      return list;
+    }
+    n = reader->index[b].points;
+    buffer.resize(n);
+    if (n) reader->read(b, &buffer[0]);
+    return n ? &buffer[0] : NULL;
+  }
+};
+
+/** 
+ * Builds the octree in a single pass over the sorted points.
+ * 
+ * Only the node that is currently being filled is kept in memory for each layer.
+ * As the points are sorted along a space filling curve, a node is finished as soon as 
+ * a point outside of it is encountered. It is then appended to the output file.
+ * Hence the nodes are stored in post-order, except for the root, which is stored at index 0.
+ * 
+ * Unless they are known to be sorted, the points are checked for being sorted while building. 
+ * Returns false if they are not, in which case the output is incomplete.
+ */
+template<class Stream> bool stream_octree(Timer& t, const point_source& in, const char * outfile, int bottom_layer, uint32_t repeat_mask, int repeat_depth, bool check) {
+  typedef typename Stream::node node;
+  printf("[%10.0f] Storing points.\n", t.elapsed());
+  uint64_t length = in.length;
+  stats.stage("store", length);
+  Stream out(outfile);
+  node_builder<Stream> tree(out, bottom_layer);
+  int64_t old_key = 0;
+  uint64_t old = 0;
+  uint64_t nodecount[D] = {};
+  std::vector<point> buffer;
+  uint64_t i = 0;
+  for (uint64_t b=0; b<in.blocks(); b++) {
+    uint64_t n;
+    const point * list = in.block(b, buffer, n);
+    for (uint64_t k=0; k<n; k++, i++) {
+      if (i && (i&0x3fffff)==0) printf("[%10.0f] Stored %6.2f%% points (%luMiB).\n", t.elapsed(), i*100.0/length, (uint64_t)out.nodes*sizeof(node)>>20);
+      point p(list[k]);
+      if (check) {
+        int64_t key = hilbert3d(p);
+        if (old_key>key) {
+          printf("[%10.0f] Point %lu should precede previous point.\n", t.elapsed(), i);
+          return false;
+        }
+        old_key = key;
+      }
+      uint64_t val = morton3d(p.z, p.y, p.x);
+      for (int j=0; j<D && (i==0 || (val>>j*3) != (old>>j*3)); j++) nodecount[j]++;
+      tree.add(val, p.c);
+      old = val;
+    }
+  }
+  printf("[%10.0f] Found %lu points in %lu voxels (%.2f points per voxel).\n", t.elapsed(), length, nodecount[0], nodecount[0] ? (double)length/nodecount[0] : 0.0);
+  
+  // Close the remaining data layers, their top node becomes the root.
+  int layers = tree.layers();
+  printf("[%10.0f] Found 1 leaf layer + %d data layers + %d repetition layers.\n", t.elapsed(), layers, repeat_depth);
+  node root = tree.close(layers);
+  
+  // Add the repetition layers on top.
+  for (int j=0; j<repeat_depth; j++) {
+    node up;
+    clear(up);
+    up.avgcolor[0] = average(root);
+    up.child[0] = out.add(root);
+    replicate(up, repeat_mask);
+    root = up;
+  }
+  out.set_root(root);
+  stats.set("voxels", nodecount[0]);
+  stats.set("layers", layers+repeat_depth);
+  stats.set("nodes_per_layer", nodecount, layers+1);
+  stats.set("nodes", out.nodes);
+  printf("[%10.0f] Wrote %lu nodes of %luB each (%luMiB).\n", t.elapsed(), (uint64_t)out.nodes, sizeof(node), (uint64_t)out.nodes*sizeof(node)>>20);
+  return true;
 }
-uint32_t rgb(float r, float g, float b) {
-  return rgb((int32_t)(r+0.5),(int32_t)(g+0.5),(int32_t)(b+0.5));
+
+/**
+ * Builds the octree in a single pass, see stream_octree.
+ * The number of nodes is not known beforehand, hence it is bounded by the number of points per layer
+ * and by the size of each layer. If this bound does not fit 32-bit indices, the octree is stored in a 
+ * '.oct64' file instead, like build_octree does.
+ */
+static bool build_stream(Timer& t, const point_source& in, const char * outfile, int bottom_layer, uint32_t repeat_mask, int repeat_depth, bool check=true) {
+  uint64_t bound = repeat_depth;
+  for (int j=bottom_layer+1; j<=D; j++) {
+    uint64_t layer_size = 1ul<<(D-j)*3;
+    bound += std::min(layer_size, in.length);
+  }
+  bool sorted;
+  char wide_outfile[strlen(outfile)+3];
+  if (bound < ~0u) {
+    sorted = stream_octree<octree_stream>(t, in, outfile, bottom_layer, repeat_mask, repeat_depth, check);
+  } else {
+    sprintf(wide_outfile, "%s64", outfile);
+    printf("[%10.0f] Using 64-bit node indices.\n", t.elapsed());
+    outfile = wide_outfile;
+    stats.set("output", outfile);
+    sorted = stream_octree<octree64_stream>(t, in, outfile, bottom_layer, repeat_mask, repeat_depth, check);
+  }
+  if (sorted) write_pruned_layers(outfile, bottom_layer);
+  return sorted;
 }
 
-uint32_t average(octree* root, int index) {
-  for (int i=0; i<8; i++) {
-    if(~root[index].child[i]) {
-      root[index].avgcolor[i] = average(root, root[index].child[i]);
+/** Result of scanning a chunk of points. */
+struct scan_chunk {
+  const point * list;
+  uint64_t length;
+  bool check;
+  bool sorted;
+  uint64_t bits;
+  uint64_t nodecount[D];
+};
+
+/** Checks whether a chunk is sorted and counts the nodes per layer that it touches. */
+static void scan_task(uint64_t i, void * data) {
+  scan_chunk& c = ((scan_chunk*)data)[i];
+  c.sorted = true;
+  c.bits = 0;
+  for (int j=0; j<D; j++) c.nodecount[j]=0;
+  int64_t old_key = 0;
+  uint64_t old = 0;
+  for (uint64_t k=0; k<c.length; k++) {
+    point p(c.list[k]);
+    assert(p.c<0x1000000);
+    if (c.check) {
+      int64_t key = hilbert3d(p);
+      if (old_key>key) c.sorted = false;
+      old_key = key;
     }
+    uint64_t val = morton3d(p.z, p.y, p.x);
+    for (int j=0; j<D; j++) {
+      if (k==0 || (val>>j*3)!=(old>>j*3)) c.nodecount[j]++;
+    }
+    c.bits |= val;
+    old = val;
   }
-  float r=0, g=0, b=0;
-  int n=0;
-  for (int i=0; i<8; i++) {
-    if(root[index].avgcolor[i]>=0) {
-      int v = root[index].avgcolor[i];
-      r += (v&0xff0000)>>16;
-      g += (v&0xff00)>>8;
-      b += (v&0xff);
-      n++;
+}
+
+/**
+ * Checks whether the points are sorted, unless they are known to be, and counts the nodes per layer, using multiple threads.
+ * The node counts are only valid if the points are sorted.
+ */
+static bool scan_points(Timer& t, const pointset& in, int threads, uint64_t * nodecount, uint64_t& bits, bool check=true) {
+  static const uint64_t CHUNK = 1<<20;
+  if (check) {
+    printf("[%10.0f] Checking if %lu points are sorted and counting nodes per layer.\n", t.elapsed(), in.length);
+  } else {
+    printf("[%10.0f] Counting nodes per layer of %lu points.\n", t.elapsed(), in.length);
+  }
+  stats.stage("scan", in.length);
+  std::vector<scan_chunk> chunks((in.length+CHUNK-1)/CHUNK);
+  for (uint64_t i=0; i<chunks.size(); i++) {
+    chunks[i].list = in.list + i*CHUNK;
+    chunks[i].length = std::min(CHUNK, in.length - i*CHUNK);
+    chunks[i].check = check;
+  }
+  parallel_for(threads, chunks.size(), scan_task, chunks.data());
+  
+  // Combine the results, correcting for nodes that span multiple chunks.
+  bool sorted = true;
+  bits = 0;
+  for (int j=0; j<D; j++) nodecount[j]=0;
+  for (uint64_t i=0; i<chunks.size(); i++) {
+    const scan_chunk& c = chunks[i];
+    sorted &= c.sorted;
+    bits |= c.bits;
+    for (int j=0; j<D; j++) nodecount[j]+=c.nodecount[j];
+    if (i) {
+      const point& p = c.list[-1];
+      const point& q = c.list[0];
+      if (check && hilbert3d(p) > hilbert3d(q)) sorted = false;
+      uint64_t old = morton3d(p.z, p.y, p.x);
+      uint64_t val = morton3d(q.z, q.y, q.x);
+      for (int j=0; j<D; j++) {
+        if ((val>>j*3)==(old>>j*3)) nodecount[j]--;
+      }
     }
   }
-  return rgb(r/n,g/n,b/n);
+  if (!sorted) printf("[%10.0f] Points are not sorted.\n", t.elapsed());
+  return sorted;
 }
 
-void replicate(octree* root, int index, uint32_t mask, uint32_t depth) {
-    if (depth<=0) return;
-    for (uint32_t i=0; i<8; i++) {
-        if (i == (i&mask)) {
-            if (~root[index].child[i]) replicate(root, root[index].child[i], mask, depth-1);
-        } else {
-            root[index].child[i] = root[index].child[i&mask];
-            root[index].avgcolor[i] = root[index].avgcolor[i&mask];
-        }
+/** Marks child references in the top layers that refer to a subtree. */
+static const uint32_t SUBTREE = 0x80000000u;
+
+/** A subtree that is built by one of the worker threads. */
+struct build_task {
+  const point * list;
+  uint64_t length;
+  int depth; /// Layer of the subtree's root.
+  octree_arena arena; /// Nodes of the subtree in post-order, hence the root is last.
+  uint32_t color; /// Average color of the subtree.
+  bool done; /// Whether the subtree is built, but not yet written.
+  uint32_t root; /// Index of the root of the subtree in the output, once it is written.
+};
+
+struct parallel_build {
+  int bottom_layer;
+  uint64_t grain; /// Maximum number of points in a subtree.
+  uint64_t window; /// Maximum number of subtrees that are built ahead of the first one that is not written.
+  std::vector<octree> top; /// Nodes above the subtrees, in post-order.
+  std::vector<build_task> tasks;
+  octree_stream * out;
+  uint64_t written; /// Number of subtrees written to the output.
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+/** Compares the position of points along the hilbert curve at a given layer. */
+struct prefix_less {
+  int shift;
+  bool operator()(uint64_t key, const point& p) const { return key < hilbert3d(p)>>shift; }
+};
+
+/** 
+ * Divides the points of a node at the given depth among its children. 
+ * Children with few points become subtrees, others are divided recursively.
+ * The node is added to the top layers and its index is returned.
+ */
+static uint32_t partition(parallel_build& b, const point * list, uint64_t length, int depth) {
+  octree node;
+  clear(node);
+  prefix_less less = {(depth-1)*3};
+  uint64_t i = 0;
+  while (i<length) {
+    uint64_t n = std::upper_bound(list+i, list+length, hilbert3d(list[i])>>less.shift, less) - (list+i);
+    const point& p = list[i];
+    int idx = (morton3d(p.z, p.y, p.x) >> (depth-1)*3)&7;
+    if (depth-1 == b.bottom_layer) {
+      color_sum leaf;
+      for (uint64_t k=i; k<i+n; k++) leaf.add(list[k].c);
+      node.avgcolor[idx] = leaf.average();
+    } else if (n <= b.grain) {
+      node.child[idx] = SUBTREE | b.tasks.size();
+      b.tasks.push_back(build_task());
+      build_task& task = b.tasks.back();
+      task.list = list+i;
+      task.length = n;
+      task.depth = depth-1;
+      task.done = false;
+    } else {
+      node.child[idx] = partition(b, list+i, n, depth-1);
     }
+    i += n;
+  }
+  b.top.push_back(node);
+  return b.top.size()-1;
 }
 
-void clear(octree& n) {
-  for (int i=0; i<8; i++) {
-    n.avgcolor[i]=-1;
-    n.child[i]=~0u;
+/** Appends a subtree to the output, offsetting its child indices, and releases its arena. */
+static void write_subtree(parallel_build& b, build_task& task) {
+  uint32_t offset = b.out->nodes;
+  for (uint64_t k=0; k<task.arena.nodes.size(); k++) {
+    octree n = task.arena.nodes[k];
+    for (int j=0; j<8; j++) {
+      if (~n.child[j]) n.child[j] += offset;
+    }
+    b.out->add(n);
   }
+  task.root = b.out->nodes - 1;
+  std::vector<octree>().swap(task.arena.nodes);
 }
 
-int main(int argc, char ** argv){
-  Timer t;
-  if (argc != 2 && argc != 4) {
-    fprintf(stderr,"Please specify the file to convert (without '.vxl') and optionally repeat mask & depth.\n");
-    exit(2);
+/** 
+ * Builds a subtree into its arena, in the same way build_stream builds the entire octree.
+ * Finished subtrees are written in order, by the thread that finishes the first subtree that is not yet written. 
+ * A subtree is not started until it is within the window of the first subtree that is not yet written, 
+ * such that only a few subtrees are kept in memory.
+ */
+static void subtree_task(uint64_t i, void * data) {
+  parallel_build& b = *(parallel_build*)data;
+  build_task& task = b.tasks[i];
+  pthread_mutex_lock(&b.lock);
+  while (i >= b.written + b.window) pthread_cond_wait(&b.changed, &b.lock);
+  pthread_mutex_unlock(&b.lock);
+  
+  node_builder<octree_arena> tree(task.arena, b.bottom_layer);
+  for (uint64_t k=0; k<task.length; k++) {
+    point p(task.list[k]);
+    tree.add(morton3d(p.z, p.y, p.x), p.c);
   }
+  octree top = tree.close(task.depth);
+  task.color = average(top);
+  task.arena.add(top);
   
-  // Determine repeat arguments
-  int repeat_mask=7;
-  int repeat_depth=0;
-  if (argc == 4) {
-    char * endptr = NULL;
-    repeat_mask  = strtol(argv[2], &endptr, 10);
-    if (errno) {perror("Could not parse mask"); exit(1);}
-    assert(endptr);
-    assert(endptr[0]==0);
-    assert(repeat_mask>=0 && repeat_mask<8);
-    repeat_depth = strtol(argv[3], &endptr, 10);
-    if (errno) {perror("Could not parse depth"); exit(1);}
-    assert(endptr);
-    assert(endptr[0]==0);
-    assert(repeat_depth>=0 && repeat_depth<16);
-    int dirs = (0x01121223>>repeat_mask*4) & 3;
-    printf("[%10.0f] Result cloned %d times at %d layers in %s%s%s direction(s).\n", t.elapsed(), 1<<dirs*repeat_depth, repeat_depth, repeat_mask&4?"":"X", repeat_mask&2?"":"Y", repeat_mask&1?"":"Z");
+  pthread_mutex_lock(&b.lock);
+  task.done = true;
+  while (b.written < b.tasks.size() && b.tasks[b.written].done) {
+    write_subtree(b, b.tasks[b.written]);
+    b.written++;
   }
+  pthread_cond_broadcast(&b.changed);
+  pthread_mutex_unlock(&b.lock);
+}
 
-  // Determine the file names.
-  char * name = argv[1];
-  int length=strlen(name);
-  char infile[length+9];
-  char outfile[length+9];
-  sprintf(infile, "vxl/%s.vxl", name);
-  sprintf(outfile, "vxl/%s.oct", name);
+/** 
+ * Builds the octree from the sorted points using multiple threads.
+ * 
+ * The sorted points are partitioned into ranges that each form a subtree. 
+ * These subtrees are built in memory by the worker threads and written to the output file in order,
+ * followed by the nodes in the layers above them. The root is stored at index 0.
+ * At most two subtrees per thread are kept in memory.
+ */
+static void build_parallel(Timer& t, const pointset& in, const char * outfile, int threads, int layers, int bottom_layer, uint32_t repeat_mask, int repeat_depth) {
+  parallel_build b;
+  b.bottom_layer = bottom_layer;
+  b.grain = std::max<uint64_t>(in.length/threads/16, 1<<16);
+  b.window = threads*2;
+  printf("[%10.0f] Partitioning points into subtrees.\n", t.elapsed());
+  stats.stage("partition", in.length);
+  uint32_t root = partition(b, in.list, in.length, layers);
+  for (int j=0; j<repeat_depth; j++) {
+    octree up;
+    clear(up);
+    up.child[0] = root;
+    replicate(up, repeat_mask);
+    b.top.push_back(up);
+    root = b.top.size()-1;
+  }
   
-  // Map input file to memory
-  printf("[%10.0f] Opening '%s' read/write.\n", t.elapsed(), infile);
-  pointset in(infile, true);
-
-  // Check and possibly sort the data points.
-  printf("[%10.0f] Checking if %d points are sorted.\n", t.elapsed(), in.length);
-  int64_t old = 0;
-  for (uint64_t i=0; i<in.length; i++) {
-    if (i && (i&0x3fffff)==0) {
-      printf("[%10.0f] Checking ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
-    }
-    int64_t cur = hilbert3d(in.list[i]);
-    if (old>cur) {
-      printf("[%10.0f] Point %lu should precede previous point.\n", t.elapsed(), i);
-      if (in.write) {
-        printf("[%10.0f] Sorting points.\n", t.elapsed());
-        in.enable_write(true);
-        // TODO: replace with IO-efficient k-way quicksort, with inline hilbert curve computation.
-        // TODO: branch into multiple threads at some point if meaningful.
-        std::sort(in.list, in.list+in.length, hilbert3d_compare);
-        in.enable_write(false);
+  // Build the subtrees and write them directly after the root.
+  printf("[%10.0f] Building and storing %lu subtrees using %d threads.\n", t.elapsed(), b.tasks.size(), threads);
+  stats.stage("subtrees", in.length);
+  octree_stream out(outfile);
+  b.out = &out;
+  b.written = 0;
+  pthread_mutex_init(&b.lock, NULL);
+  pthread_cond_init(&b.changed, NULL);
+  parallel_for(threads, b.tasks.size(), subtree_task, &b);
+  pthread_cond_destroy(&b.changed);
+  pthread_mutex_destroy(&b.lock);
+  assert(b.written == b.tasks.size());
+  
+  // Compute the colors of the top layers, remap their child indices and write them after the subtrees.
+  printf("[%10.0f] Storing %lu nodes in the top layers.\n", t.elapsed(), b.top.size());
+  stats.stage("top", b.top.size());
+  uint32_t top_offset = out.nodes;
+  std::vector<uint32_t> color(b.top.size());
+  for (uint64_t k=0; k<b.top.size(); k++) {
+    octree& n = b.top[k];
+    for (int i=0; i<8; i++) {
+      uint32_t c = n.child[i];
+      if (!~c) continue;
+      if (c & SUBTREE) {
+        const build_task& task = b.tasks[c & ~SUBTREE];
+        n.avgcolor[i] = task.color;
+        n.child[i] = task.root;
       } else {
-        printf("[%10.0f] Cannot proceed as '%s' is read only.\n", t.elapsed(), infile);
-        exit(1);
+        n.avgcolor[i] = color[c];
+        n.child[i] = top_offset + c;
       }
-      break;
     }
-    old = cur;
+    color[k] = average(n);
+    if (k != root) out.add(n);
   }
-  
-  // Count nodes per layer
-  // Used to determine file structure and size.
-  // Layers are counted as well.
-  printf("[%10.0f] Counting nodes per layer.\n", t.elapsed());
-  uint64_t nodecount[D];
-  int64_t maxnode=0;
-  for (int j=0; j<D; j++) nodecount[j]=0;
-  old = -1;
+  out.set_root(b.top[root]);
+  write_pruned_layers(outfile, bottom_layer);
+  stats.set("nodes", out.nodes);
+  printf("[%10.0f] Wrote %u nodes of %luB each (%luMiB).\n", t.elapsed(), out.nodes, sizeof(octree), out.nodes*sizeof(octree)>>20);
+}
+
+/** Checks whether the points are sorted, as a stage of the build. */
+static bool check_points(Timer& t, const pointset& in) {
+  stats.stage("check", in.length);
+  return check_sorted(t, in);
+}
+
+/** Writes the spatial index of the sorted points, which allows crop to read only part of them. */
+static void index_points(Timer& t, const pointset& in, const char * infile) {
+  printf("[%10.0f] Writing index '%s.idx'.\n", t.elapsed(), infile);
+  vxl_index index;
+  index.build(in);
+  index.write(infile);
+}
+
+/** 
+ * Marks the points as sorted in the metadata, such that later builds can skip the check, and indexes them.
+ * A compressed pointset is marked, but not indexed, as crop reads only uncompressed pointsets partially.
+ */
+static void mark_points(Timer& t, const pointset& in, const char * infile) {
+  if (in.in_memory && !in.compressed) return;
+  mark_sorted(infile, true, in.length);
+  if (!in.compressed) index_points(t, in, infile);
+}
+
+/** Sorts the points and marks them as sorted, unless mark is false because the caller changes them further. */
+static void sort_points(Timer& t, pointset& in, const char * infile, bool mark=true) {
+  if (in.write) {
+    printf("[%10.0f] Sorting points.\n", t.elapsed());
+    stats.stage("sort", in.length);
+    in.enable_write(true);
+    // TODO: replace with IO-efficient k-way quicksort, with inline hilbert curve computation.
+    // TODO: branch into multiple threads at some point if meaningful.
+    std::sort(in.list, in.list+in.length, hilbert3d_compare);
+    in.enable_write(false);
+    // A compressed pointset is sorted in memory only.
+    if (mark && !in.in_memory) mark_points(t, in, infile);
+  } else {
+    printf("[%10.0f] Cannot proceed as '%s' is read only.\n", t.elapsed(), infile);
+    exit(1);
+  }
+}
+
+/**
+ * Merges sorted points with equal coordinates into a single point with their average color.
+ * The remaining points are moved to the front and the file is truncated accordingly.
+ */
+static void merge_points(Timer& t, pointset& in, const char * infile) {
+  if (!in.write) {
+    printf("[%10.0f] Cannot merge points as '%s' is read only.\n", t.elapsed(), infile);
+    exit(1);
+  }
+  printf("[%10.0f] Merging points with equal coordinates.\n", t.elapsed());
+  stats.stage("merge", in.length);
+  in.enable_write(true);
+  uint64_t n = 0;
+  color_sum sum;
   for (uint64_t i=0; i<in.length; i++) {
     if (i && (i&0x3fffff)==0) {
-      printf("[%10.0f] Counting ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
+      printf("[%10.0f] Merging ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
     }
-    point q = in.list[i];
-    assert(q.c<0x1000000);    
-    int64_t cur = morton3d(q.x, q.y, q.z);
-    for (int j=0; j<D; j++) {
-      if ((cur>>j*3)!=(old>>j*3)) {
-        nodecount[j]++;
-      }
+    point p(in.list[i]);
+    point& q = in.list[n];
+    if (sum.n && (p.x!=q.x || p.y!=q.y || p.z!=q.z)) {
+      q.c = sum.average();
+      sum = color_sum();
+      n++;
     }
-    old = cur;
-    if (maxnode<cur)
-      maxnode=cur;
+    if (!sum.n) in.list[n] = p;
+    sum.add(p.c);
   }
-  printf("[%10.0f] Counting layers (maxnode=0x%lx).\n", t.elapsed(), maxnode);
+  if (sum.n) {
+    in.list[n].c = sum.average();
+    n++;
+  }
+  in.enable_write(false);
+  printf("[%10.0f] Merged %lu points into %lu voxels (%.2fx), shrinking '%s' to %luMiB.\n", t.elapsed(), in.length, n, n ? (double)in.length/n : 0.0, infile, n*sizeof(point)>>20);
+  stats.set("merged_points", in.length - n);
+  in.truncate(n);
+  if (!in.in_memory) mark_points(t, in, infile);
+}
+
+/**
+ * Builds a coarse octree from every n-th point, such that at most the given number of samples is used.
+ * Only the top layers of the octree are stored, the lower layers are pruned.
+ * As the samples are few, they are sorted in memory and the input file is left untouched.
+ */
+static void build_preview(Timer& t, const pointset& in, const char * outfile, int preview_layers, uint64_t samples, uint32_t repeat_mask, int repeat_depth) {
+  uint64_t stride = std::max<uint64_t>(in.length/samples, 1);
+  printf("[%10.0f] Sampling every %lu-th point.\n", t.elapsed(), stride);
+  stats.stage("sample", in.length/stride);
+  std::vector<point> sample;
+  sample.reserve(in.length/stride+1);
+  uint64_t bits = 0;
+  for (uint64_t i=stride/2; i<in.length; i+=stride) {
+    point p(in.list[i]);
+    sample.push_back(p);
+    bits |= morton3d(p.z, p.y, p.x);
+  }
+  std::sort(sample.begin(), sample.end(), hilbert3d_compare);
   int layers=0;
-  while(maxnode>>layers*3) layers++;
-  printf("[%10.0f] Found 1 leaf layer + %d data layers + %d repetition layers.\n", t.elapsed(), layers, repeat_depth);
-  assert(nodecount[layers]==1);
-  layers+=repeat_depth;
-  
-  // Determine lower layer prunning
+  while(bits>>layers*3) layers++;
+  int bottom_layer = std::max(layers-preview_layers, 0);
+  printf("[%10.0f] Storing %lu samples in the top %d of %d data layers.\n", t.elapsed(), sample.size(), layers-bottom_layer, layers);
+  stats.set("samples", sample.size());
+  stats.set("pruned_layers", bottom_layer);
+  bool sorted = build_stream(t, point_source(sample.data(), sample.size()), outfile, bottom_layer, repeat_mask, repeat_depth);
+  assert(sorted);
+}
+
+/** 
+ * Determines the number of lowest layers to prune and reports the node counts per layer.
+ * Returns the number of pruned layers and stores the number of remaining nodes in nodesum.
+ */
+static int prune_layers(Timer& t, uint64_t points, const uint64_t * nodecount, int layers, int prune, uint64_t& nodesum) {
+  printf("[%10.0f] Found %lu points in %lu voxels (%.2f points per voxel).\n", t.elapsed(), points, nodecount[0], nodecount[0] ? (double)points/nodecount[0] : 0.0);
   printf("[%10.0f] Determine lower layer pruning.\n", t.elapsed());
   int bottom_layer=0;
-  while(nodecount[bottom_layer]<nodecount[bottom_layer+1]*2) bottom_layer++;
+  if (prune>=0) {
+    bottom_layer=prune;
+  } else {
+    while(nodecount[bottom_layer]<nodecount[bottom_layer+1]*2) bottom_layer++;
+  }
   printf("[%10.0f] Lowest %d layers will be pruned.\n", t.elapsed(), bottom_layer);
+  stats.set("voxels", nodecount[0]);
+  stats.set("layers", layers);
+  stats.set("nodes_per_layer", nodecount, layers+1);
   
   // Report on node counts per layer and determine file size.
-  uint64_t nodesum = 0;
+  nodesum = 0;
   for (int i=0; i<=layers; i++) {
     if (i>bottom_layer) {
       printf("[%10.0f] At layer %2d: %8lu nodes.\n", t.elapsed(), i, nodecount[i]);
@@ -261,16 +580,19 @@ int main(int argc, char ** argv){
       printf("[%10.0f] At layer %2d: %8lu pruned nodes.\n", t.elapsed(), i, nodecount[i]);
     }
   }
-  uint64_t filesize = nodesum*sizeof(octree);
-  
-  // Prepare output file and map it to memory
-  printf("[%10.0f] Creating octree file with %lu nodes of %luB each (%luMiB).\n", t.elapsed(), nodesum, sizeof(octree), filesize>>20);
-  octree_file out(outfile, filesize);
-  octree* root = out.root;
+  stats.set("nodes", nodesum);
+  return bottom_layer;
+}
+
+/**
+ * Stores the sorted points in the given memory mapped nodes, of which the number per layer is known.
+ * Each layer is stored as a contiguous range of nodes, starting with the root.
+ */
+template<class Node> static void build_layered(Timer& t, const pointset& in, Node * root, const uint64_t * nodecount, int layers, int bottom_layer, uint64_t nodesum, uint32_t repeat_mask, int repeat_depth) {
   clear(root[0]);
   
   // Determine index offsets for each layer
-  uint32_t offset[D], bounds[D];
+  typename Node::index offset[D], bounds[D];
   for (int j=0; j<D; j++) {offset[j]=0; bounds[j]=0;}
   offset[layers] = 0;
   for (int i=layers-1; i>=bottom_layer; i--) {
@@ -280,25 +602,34 @@ int main(int argc, char ** argv){
   
   // Read voxels and store them.
   printf("[%10.0f] Storing points.\n", t.elapsed());
-  uint32_t i;
-  uint32_t nodes_created = 0;
+  stats.stage("store", in.length);
+  uint64_t i;
+  uint64_t nodes_created = 0;
+  int32_t * leaf = NULL;
+  uint64_t old_leaf = 0;
+  color_sum leaf_color;
   for (i=0; i<in.length; i++) {
-    if (i && (i&0x3fffff)==0) printf("[%10.0f] Stored %6.2f%% points (%luMiB).\n", t.elapsed(), i*100.0/in.length, nodes_created*sizeof(octree)>>20);
+    if (i && (i&0x3fffff)==0) printf("[%10.0f] Stored %6.2f%% points (%luMiB).\n", t.elapsed(), i*100.0/in.length, nodes_created*sizeof(Node)>>20);
     point p(in.list[i]);
     uint64_t val = morton3d(p.z, p.y, p.x);
-    octree * cur = &root[0];
+    if (leaf && old_leaf != val >> bottom_layer*3) {
+      *leaf = leaf_color.average();
+      leaf_color = color_sum();
+    }
+    old_leaf = val >> bottom_layer*3;
+    leaf_color.add(p.c);
+    Node * cur = &root[0];
     //fprintf(stderr,"val=%15lx, p{x=%d,y=%d,x=%d,c=%6x.\n", val, p.x, p.y, p.z, p.c);
     for (int depth = layers-1; depth >= bottom_layer; depth--) {
       int idx = (val >> depth*3)&7;
-      //fprintf(stderr,"i=%u, depth=%d, idx=%d, offset[depth]=%u, cur=%ld.\n", i, depth, idx, offset[depth], cur-root);
       if (depth<=bottom_layer) {
-        cur->avgcolor[idx] = p.c;
+        leaf = &cur->avgcolor[idx];
       } else {
-        if (~cur->child[idx]==0u) {
+        if (!~cur->child[idx]) {
           assert(nodes_created<nodesum);
           assert(offset[depth]<bounds[depth]);
           nodes_created++;
-          uint32_t next = offset[depth]++;
+          typename Node::index next = offset[depth]++;
           //fprintf(stderr,"Created node %d (%d)\n", next, nodes_created);
           clear(root[next]);
           cur->child[idx] = next;
@@ -308,14 +639,286 @@ int main(int argc, char ** argv){
       }
     }
   }
+  if (leaf) *leaf = leaf_color.average();
   printf("[%10.0f] Computing average colors.\n", t.elapsed());
+  stats.stage("average", nodesum);
   average(root, 0);
   
   printf("[%10.0f] Replicating model.\n", t.elapsed());
+  stats.stage("replicate", nodesum);
   replicate(root, 0, repeat_mask, repeat_depth);
+}
+
+/**
+ * Creates the octree file and builds the octree in it.
+ * If the number of nodes does not fit in 32-bit indices, a file with 64-bit indices is created 
+ * instead, of which the name ends in '.oct64'.
+ */
+static void build_octree(Timer& t, const pointset& in, const char * outfile, const uint64_t * nodecount, int layers, int bottom_layer, uint64_t nodesum, uint32_t repeat_mask, int repeat_depth) {
+  bool wide = nodesum >= ~0u;
+  char wide_outfile[strlen(outfile)+3];
+  sprintf(wide_outfile, "%s64", outfile);
+  if (wide) {
+    printf("[%10.0f] Using 64-bit node indices.\n", t.elapsed());
+    outfile = wide_outfile;
+    stats.set("output", outfile);
+  }
+  uint64_t node_size = wide ? sizeof(octree64) : sizeof(octree);
+  uint64_t filesize = nodesum*node_size;
   
-  // Done with conversion, clean up.
+  // Prepare output file and map it to memory
+  printf("[%10.0f] Creating octree file with %lu nodes of %luB each (%luMiB).\n", t.elapsed(), nodesum, node_size, filesize>>20);
+  octree_file out(outfile, filesize);
+  write_pruned_layers(outfile, bottom_layer);
+  if (wide) {
+    build_layered(t, in, out.root64, nodecount, layers, bottom_layer, nodesum, repeat_mask, repeat_depth);
+  } else {
+    build_layered(t, in, out.root, nodecount, layers, bottom_layer, nodesum, repeat_mask, repeat_depth);
+  }
+}
+
+/** Reports that the build is done and writes the report, if requested. */
+static void done(Timer& t, const char * report_file) {
+  stats.finish();
   printf("[%10.0f] Done.\n", t.elapsed());
+  if (report_file && stats.write(report_file)) {
+    printf("[%10.0f] Wrote report to '%s'.\n", t.elapsed(), report_file);
+  }
+}
+
+/** Default number of points sampled for a preview build. */
+static const int PREVIEW_SAMPLES = 1<<22;
+
+static void usage() {
+  fprintf(stderr,"Please specify the file to convert (without '.vxl') and optionally repeat mask & depth.\n");
+  fprintf(stderr,"Usage: build_db [-s | -j threads | -p layers [-n samples]] [-b layers] [-d] [-i] [-r report] pointset [mask depth]\n");
+  fprintf(stderr,"  -s         Build in a single streaming pass, writing nodes sequentially.\n");
+  fprintf(stderr,"  -j threads Build subtrees in parallel using the given number of threads (0: all processors).\n");
+  fprintf(stderr,"  -p layers  Quickly build a preview containing only the given number of top layers.\n");
+  fprintf(stderr,"  -n samples Maximum number of points sampled for the preview (default: %d).\n", PREVIEW_SAMPLES);
+  fprintf(stderr,"  -b layers  Number of lowest layers to prune (default: automatic, or 0 with -s).\n");
+  fprintf(stderr,"  -d         Merge points with equal coordinates after sorting, shrinking the input file.\n");
+  fprintf(stderr,"  -i         Read the points from standard input, instead of from 'vxl/pointset.vxl'.\n");
+  fprintf(stderr,"  -r report  Write the resource usage of each build stage as JSON to the given file.\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv){
+  Timer t;
+  
+  // Parse options
+  bool stream = false;
+  bool merge = false;
+  bool from_stdin = false;
+  int threads = -1;
+  int prune = -1;
+  int preview = 0;
+  int samples = PREVIEW_SAMPLES;
+  const char * report_file = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "sj:p:n:b:dir:")) != -1) {
+    switch (opt) {
+      case 's': stream = true; break;
+      case 'p': 
+        preview = parse_int(optarg, "number of preview layers"); 
+        if (preview<=0) usage();
+        break;
+      case 'n': 
+        samples = parse_int(optarg, "number of samples"); 
+        if (samples<=0) usage();
+        break;
+      case 'd': merge = true; break;
+      case 'i': from_stdin = true; break;
+      case 'r': report_file = optarg; break;
+      case 'j': 
+        threads = parse_int(optarg, "number of threads"); 
+        if (threads<=0) threads = processor_count();
+        break;
+      case 'b': 
+        prune = parse_int(optarg, "number of pruned layers"); 
+        assert(prune>=0 && prune<D-1);
+        break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if ((argc != 2 && argc != 4) || (stream + (threads>0) + (preview>0) > 1) || (preview && merge)) usage();
+  
+  // Determine repeat arguments
+  int repeat_mask=7;
+  int repeat_depth=0;
+  if (argc == 4) {
+    repeat_mask = parse_int(argv[2], "mask");
+    assert(repeat_mask>=0 && repeat_mask<8);
+    repeat_depth = parse_int(argv[3], "depth");
+    assert(repeat_depth>=0 && repeat_depth<16);
+    int dirs = (0x01121223>>repeat_mask*4) & 3;
+    printf("[%10.0f] Result cloned %d times at %d layers in %s%s%s direction(s).\n", t.elapsed(), 1<<dirs*repeat_depth, repeat_depth, repeat_mask&4?"":"X", repeat_mask&2?"":"Y", repeat_mask&1?"":"Z");
+  }
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char infile[length+10];
+  char outfile[length+17];
+  sprintf(infile, "vxl/%s.vxl", name);
+  if (access(infile, F_OK)) sprintf(infile, "vxl/%s.vxlz", name);
+  if (from_stdin) strcpy(infile, "-");
+  sprintf(outfile, preview ? "vxl/%s-preview.oct" : "vxl/%s.oct", name);
+  
+  // A compressed pointset that is marked as sorted is streamed block by block, instead of decompressing it into memory.
+  if (stream && !merge && !from_stdin && is_vxlz(infile)) {
+    vxlz_reader reader(infile);
+    if (reader.length && is_sorted(infile, reader.length)) {
+      printf("[%10.0f] '%s' is marked as sorted, reading it block by block.\n", t.elapsed(), infile);
+      stats.set("input", infile);
+      stats.set("output", outfile);
+      stats.set("mode", "stream");
+      stats.set("threads", 1);
+      stats.set("points", reader.length);
+      stats.set("input_bytes", reader.length*sizeof(point));
+      stats.set("repeat_layers", repeat_depth);
+      stats.set("pruned_layers", prune<0?0:prune);
+      bool sorted = build_stream(t, point_source(reader), outfile, prune<0?0:prune, repeat_mask, repeat_depth, false);
+      assert(sorted);
+      done(t, report_file);
+      return 0;
+    }
+  }
+
+  // Map input file to memory, or read the input stream into memory.
+  printf("[%10.0f] Opening '%s' %s.\n", t.elapsed(), infile, preview ? "read only" : "read/write");
+  pointset in(infile, !preview);
+  if (in.in_memory && !in.compressed) printf("[%10.0f] Read %lu points from the stream into memory.\n", t.elapsed(), in.length);
+  if (in.length == 0) {
+    fprintf(stderr, "No points found in '%s'.\n", infile);
+    exit(1);
+  }
+  stats.set("input", infile);
+  stats.set("output", outfile);
+  stats.set("mode", preview ? "preview" : stream ? "stream" : threads>0 ? "parallel" : "layered");
+  stats.set("threads", threads>0 ? threads : 1);
+  stats.set("points", in.length);
+  stats.set("input_bytes", in.size);
+  stats.set("repeat_layers", repeat_depth);
+  
+  // Points that are marked as sorted, for example by append_vxl, need not be checked.
+  // A preview leaves the files of the input untouched, hence does not index them.
+  bool sorted = (!in.in_memory || in.compressed) && is_sorted(infile, in.length);
+  if (sorted) {
+    printf("[%10.0f] '%s' is marked as sorted.\n", t.elapsed(), infile);
+    vxl_index index;
+    if (!preview && !in.compressed && !index.read(infile, in.length)) index_points(t, in, infile);
+  }
+
+  // Merge duplicate points, which requires them to be sorted.
+  if (merge) {
+    // The merge truncates the file, hence it marks and indexes the points afterwards.
+    if (!sorted && !check_points(t, in)) sort_points(t, in, infile, false);
+    sorted = true;
+    merge_points(t, in, infile);
+  }
+
+  if (preview) {
+    build_preview(t, in, outfile, preview, samples, repeat_mask, repeat_depth);
+    done(t, report_file);
+    return 0;
+  }
+
+  if (stream) {
+    stats.set("pruned_layers", prune<0?0:prune);
+    madvise(in.list, in.size, MADV_SEQUENTIAL);
+    if (!build_stream(t, point_source(in.list, in.length), outfile, prune<0?0:prune, repeat_mask, repeat_depth, !sorted)) {
+      sort_points(t, in, infile);
+      bool sorted = build_stream(t, point_source(in.list, in.length), outfile, prune<0?0:prune, repeat_mask, repeat_depth);
+      assert(sorted);
+    } else if (!sorted) {
+      mark_points(t, in, infile);
+    }
+    done(t, report_file);
+    return 0;
+  }
+  
+  if (threads>0) {
+    uint64_t nodecount[D];
+    uint64_t bits;
+    if (!scan_points(t, in, threads, nodecount, bits, !sorted)) {
+      sort_points(t, in, infile);
+      bool sorted = scan_points(t, in, threads, nodecount, bits);
+      assert(sorted);
+    } else if (!sorted) {
+      mark_points(t, in, infile);
+    }
+    int layers=0;
+    while(bits>>layers*3) layers++;
+    printf("[%10.0f] Found 1 leaf layer + %d data layers + %d repetition layers.\n", t.elapsed(), layers, repeat_depth);
+    uint64_t nodesum;
+    int bottom_layer = prune_layers(t, in.length, nodecount, layers+repeat_depth, prune, nodesum);
+    stats.set("pruned_layers", bottom_layer);
+    if (nodesum >= SUBTREE) {
+      // The parallel build uses 32-bit indices, of which the top bit marks subtrees.
+      printf("[%10.0f] Too many nodes for a parallel build, building layer by layer instead.\n", t.elapsed());
+      stats.set("mode", "layered");
+      build_octree(t, in, outfile, nodecount, layers+repeat_depth, bottom_layer, nodesum, repeat_mask, repeat_depth);
+      done(t, report_file);
+      return 0;
+    }
+    if (layers<=bottom_layer) layers=bottom_layer+1;
+    build_parallel(t, in, outfile, threads, layers, bottom_layer, repeat_mask, repeat_depth);
+    done(t, report_file);
+    return 0;
+  }
+
+  // Check and possibly sort the data points.
+  if (!sorted) {
+    if (check_points(t, in)) {
+      mark_points(t, in, infile);
+    } else {
+      sort_points(t, in, infile);
+    }
+  }
+  
+  // Count nodes per layer
+  // Used to determine file structure and size.
+  // Layers are counted as well.
+  printf("[%10.0f] Counting nodes per layer.\n", t.elapsed());
+  stats.stage("count", in.length);
+  uint64_t nodecount[D];
+  int64_t maxnode=0;
+  for (int j=0; j<D; j++) nodecount[j]=0;
+  int64_t old = -1;
+  for (uint64_t i=0; i<in.length; i++) {
+    if (i && (i&0x3fffff)==0) {
+      printf("[%10.0f] Counting ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
+    }
+    point q = in.list[i];
+    assert(q.c<0x1000000);    
+    int64_t cur = morton3d(q.x, q.y, q.z);
+    for (int j=0; j<D; j++) {
+      if ((cur>>j*3)!=(old>>j*3)) {
+        nodecount[j]++;
+      }
+    }
+    old = cur;
+    if (maxnode<cur)
+      maxnode=cur;
+  }
+  printf("[%10.0f] Counting layers (maxnode=0x%lx).\n", t.elapsed(), maxnode);
+  int layers=0;
+  while(maxnode>>layers*3) layers++;
+  printf("[%10.0f] Found 1 leaf layer + %d data layers + %d repetition layers.\n", t.elapsed(), layers, repeat_depth);
+  assert(nodecount[layers]==1);
+  layers+=repeat_depth;
+  
+  // Determine lower layer prunning
+  uint64_t nodesum;
+  int bottom_layer = prune_layers(t, in.length, nodecount, layers, prune, nodesum);
+  stats.set("pruned_layers", bottom_layer);
+  build_octree(t, in, outfile, nodecount, layers, bottom_layer, nodesum, repeat_mask, repeat_depth);
+  
+  // Done with conversion, clean up.
+  done(t, report_file);
 }
 
 // kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,155 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pointset.h"
+#include "morton.h"
+#include "timing.h"
+#include "vxl_index.h"
+#include "options.h"
+
+/* Extracts the points within an axis aligned box from a pointset.
+ *
+ * If the pointset is sorted, its spatial index is used to read only the ranges of the pointset 
+ * that contain points of the box, each of which is read sequentially. 
+ * The index is created if it does not exist yet. Otherwise all points are read.
+ */
+
+static void usage() {
+  fprintf(stderr,"Please specify the pointset, the result (without '.vxl') and the box to extract.\n");
+  fprintf(stderr,"Usage: crop [-u] pointset result x0 y0 z0 x1 y1 z1\n");
+  fprintf(stderr,"  The box contains the points with x0 <= x < x1, y0 <= y < y1 and z0 <= z < z1.\n");
+  fprintf(stderr,"  -u The box is given in the units of the input, using 'vxl/pointset.vxl.meta'.\n");
+  exit(2);
+}
+
+/** Checks whether the points are sorted along the hilbert curve. */
+int main(int argc, char ** argv) {
+  Timer t;
+  bool units = false;
+  int opt;
+  // Options are parsed up to the pointset only, such that the coordinates can be negative.
+  while ((opt = getopt(argc, argv, "+u")) != -1) {
+    switch (opt) {
+      case 'u': units = true; break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 9) usage();
+
+  // Determine the file names.
+  char * name = argv[1];
+  char * result = argv[2];
+  char infile[strlen(name)+10];
+  char outfile[strlen(result)+9];
+  sprintf(infile, "vxl/%s.vxl", name);
+  if (access(infile, F_OK)) sprintf(infile, "vxl/%s.vxlz", name);
+  sprintf(outfile, "vxl/%s.vxl", result);
+  quantization q;
+  bool has_meta = q.read(infile);
+
+  // Determine the box in the coordinates of the points.
+  double box[6];
+  const char * names[6] = {"x0", "y0", "z0", "x1", "y1", "z1"};
+  for (int i=0; i<6; i++) box[i] = parse_double(argv[3+i], names[i]);
+  if (units) {
+    if (!has_meta) {
+      fprintf(stderr, "Cannot convert the box as '%s.meta' does not exist.\n", infile);
+      exit(1);
+    }
+    for (int i=0; i<6; i++) box[i] = (box[i] - q.offset[i%3]) * q.scale;
+  }
+  uint32_t min[3], max[3];
+  for (int i=0; i<3; i++) {
+    // Points are rounded to the nearest integer coordinate.
+    min[i] = box[i] <= 0 ? 0 : box[i] >= 4294967295.0 ? 4294967295u : (uint32_t)ceil(box[i] - 0.5);
+    max[i] = box[i+3] <= 0 ? 0 : box[i+3] >= 4294967295.0 ? 4294967295u : (uint32_t)ceil(box[i+3] - 0.5);
+  }
+  printf("[%10.0f] Extracting box (%u, %u, %u) - (%u, %u, %u) from '%s'.\n", t.elapsed(), min[0], min[1], min[2], max[0], max[1], max[2], infile);
+
+  // Determine the ranges of points that must be read.
+  pointset in(infile);
+  std::vector<point_range> ranges;
+  bool sorted = false;
+  if (!in.in_memory) {
+    vxl_index index;
+    if (index.read(infile, in.length)) {
+      sorted = true;
+    } else if (is_sorted(infile, in.length) || check_sorted(t, in)) {
+      printf("[%10.0f] Writing index '%s.idx'.\n", t.elapsed(), infile);
+      mark_sorted(infile, true, in.length);
+      index.build(in);
+      index.write(infile);
+      sorted = true;
+    }
+    if (sorted) index.find(min, max, ranges);
+  }
+  if (!sorted) {
+    printf("[%10.0f] '%s' cannot be indexed, hence all points are read.\n", t.elapsed(), infile);
+    ranges.push_back(point_range(0, in.length));
+  }
+  uint64_t total = 0;
+  for (uint64_t r=0; r<ranges.size(); r++) total += ranges[r].second - ranges[r].first;
+  printf("[%10.0f] Reading %lu of %lu points (%.2f%%) in %lu ranges.\n", t.elapsed(), total, in.length, in.length ? total*100.0/in.length : 0.0, ranges.size());
+
+  // Copy the points within the box.
+  uint64_t count = 0;
+  {
+    pointfile out(outfile);
+    uint64_t done = 0;
+    for (uint64_t r=0; r<ranges.size(); r++) {
+      const point * begin = in.list + ranges[r].first;
+      const point * end = in.list + ranges[r].second;
+      if (!in.in_memory) {
+        // Align the advised region to pages, as madvise requires.
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t from = (uintptr_t)begin & ~(page-1);
+        madvise((void*)from, (uintptr_t)end - from, MADV_SEQUENTIAL);
+      }
+      for (const point * p = begin; p < end; p++, done++) {
+        if (done && (done&0x3fffff)==0) printf("[%10.0f] Reading ... %6.2f%%.\n", t.elapsed(), done*100.0/total);
+        if (p->x >= min[0] && p->x < max[0] && p->y >= min[1] && p->y < max[1] && p->z >= min[2] && p->z < max[2]) {
+          out.add(*p);
+          count++;
+        }
+      }
+    }
+  }
+  printf("[%10.0f] Wrote %lu points to '%s'.\n", t.elapsed(), count, outfile);
+
+  // The result has the same coordinates as the pointset, and is sorted and indexed as well.
+  if (has_meta) q.write(outfile);
+  if (sorted) mark_sorted(outfile, true, count);
+  if (sorted && count) {
+    pointset cropped(outfile);
+    vxl_index index;
+    index.build(cropped);
+    index.write(outfile);
+  }
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,145 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+
+#include "pointset.h"
+#include "octree.h"
+#include "morton.h"
+#include "timing.h"
+#include "options.h"
+
+/* Applies the points in the given pointsets as insertions and deletions to an existing octree,
+ * without rebuilding it.
+ *
+ * The points use the same coordinates as the pointset the octree was built from.
+ * They are shifted by the number of pruned layers, such that they match the leaves of the octree.
+ * build_db records this number in 'name.oct.meta', which is used unless it is given explicitly.
+ */
+
+static int prune = -1;
+
+static bool morton_compare(const point& a, const point& b) {
+  return morton3d(a.z, a.y, a.x) < morton3d(b.z, b.y, b.x);
+}
+
+/** Removes the voxels containing the points in the given file. */
+static void erase(Timer& t, octree_edit& out, const char * file) {
+  pointset in(file);
+  printf("[%10.0f] Removing %lu points from '%s'.\n", t.elapsed(), in.length, file);
+  uint64_t removed = 0;
+  for (uint64_t i=0; i<in.length; i++) {
+    point p(in.list[i]);
+    if (out.erase(p.x>>prune, p.y>>prune, p.z>>prune)) removed++;
+  }
+  printf("[%10.0f] Removed %lu voxels.\n", t.elapsed(), removed);
+}
+
+/** Inserts the points in the given file, averaging the colors of points that fall in the same voxel. */
+static void insert(Timer& t, octree_edit& out, const char * file) {
+  pointset in(file);
+  printf("[%10.0f] Inserting %lu points from '%s'.\n", t.elapsed(), in.length, file);
+  std::vector<point> list(in.list, in.list+in.length);
+  for (uint64_t i=0; i<list.size(); i++) {
+    list[i].x >>= prune;
+    list[i].y >>= prune;
+    list[i].z >>= prune;
+  }
+  std::sort(list.begin(), list.end(), morton_compare);
+  uint64_t inserted = 0, outside = 0;
+  color_sum sum;
+  for (uint64_t i=0; i<list.size(); i++) {
+    point p(list[i]);
+    sum.add(p.c);
+    if (i+1 < list.size() && p.x==list[i+1].x && p.y==list[i+1].y && p.z==list[i+1].z) continue;
+    if (out.insert(p.x, p.y, p.z, sum.average())) {
+      inserted++;
+    } else {
+      outside++;
+    }
+    sum = color_sum();
+  }
+  printf("[%10.0f] Inserted %lu voxels, skipped %lu voxels outside of the octree.\n", t.elapsed(), inserted, outside);
+}
+
+static void usage() {
+  fprintf(stderr,"Please specify the octree to edit (without '.oct') and the points to insert and/or remove.\n");
+  fprintf(stderr,"Usage: edit_db [-b layers] [-d points.vxl] [-a points.vxl] name\n");
+  fprintf(stderr,"  -b layers     Number of layers that were pruned when building the octree (default: as recorded by build_db, or 0).\n");
+  fprintf(stderr,"  -d points.vxl Remove the voxels containing these points.\n");
+  fprintf(stderr,"  -a points.vxl Insert these points, replacing the color of existing voxels.\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+
+  // Parse options
+  const char * insert_file = NULL;
+  const char * erase_file = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:d:a:")) != -1) {
+    switch (opt) {
+      case 'b':
+        prune = parse_int(optarg, "number of pruned layers");
+        assert(prune>=0 && prune<D-1);
+        break;
+      case 'd': erase_file = optarg; break;
+      case 'a': insert_file = optarg; break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2 || (!insert_file && !erase_file)) usage();
+
+  // Determine the file name.
+  char * name = argv[1];
+  char outfile[strlen(name)+9];
+  sprintf(outfile, "vxl/%s.oct", name);
+
+  // Use the number of pruned layers that build_db recorded, which must match the given one.
+  int recorded = read_pruned_layers(outfile);
+  if (prune < 0) {
+    prune = recorded < 0 ? 0 : recorded;
+  } else if (recorded >= 0 && prune != recorded) {
+    fprintf(stderr, "The octree was built with %d pruned layers, not %d.\n", recorded, prune);
+    exit(1);
+  }
+  printf("[%10.0f] Using %d pruned layers.\n", t.elapsed(), prune);
+
+  printf("[%10.0f] Opening '%s' for editing.\n", t.elapsed(), outfile);
+  octree_edit out(outfile);
+  printf("[%10.0f] Octree has %u nodes in %d layers.\n", t.elapsed(), out.nodes, out.depth);
+
+  // Deletions are applied first, such that a voxel can be replaced.
+  if (erase_file) erase(t, out, erase_file);
+  if (insert_file) insert(t, out, insert_file);
+
+  printf("[%10.0f] Committing %u modified nodes.\n", t.elapsed(), out.modified());
+  out.commit();
+  printf("[%10.0f] Done, octree has %u nodes.\n", t.elapsed(), out.nodes);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,308 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+
+#include "octree.h"
+#include "morton.h"
+#include "timing.h"
+#include "options.h"
+
+/* Generates synthetic scenes and writes them directly as octree, without creating points first.
+ *
+ * The scenes are generated by descending the octree in Morton order, skipping nodes that the scene does not overlap.
+ * The voxels are passed to an octree_builder, which writes the nodes in a single pass.
+ * Random numbers are derived from the seed by hashing, hence the output only depends on the arguments.
+ */
+
+static void usage() {
+  fprintf(stderr,"Please specify the type of scene and its name.\n");
+  fprintf(stderr,"Usage: gen_scene [-d depth] [-r density] [-s seed] [-b layers] type name\n");
+  fprintf(stderr,"  type is one of:\n");
+  fprintf(stderr,"    block   A solid block filling the given fraction of the volume (default: 1).\n");
+  fprintf(stderr,"    cloud   Random voxels filling the given fraction of the volume (default: 0.001).\n");
+  fprintf(stderr,"    sponge  A Menger sponge, with as many levels as fit at the given density (default: 0).\n");
+  fprintf(stderr,"    terrain A noise terrain, of which the relief spans the given fraction of the height (default: 0.25).\n");
+  fprintf(stderr,"  -d Number of layers of the octree, the scene is 2^depth voxels wide (default: 10).\n");
+  fprintf(stderr,"  -s Seed of the random numbers (default: 1).\n");
+  fprintf(stderr,"  -b Number of bottom layers to prune (default: 0).\n");
+  fprintf(stderr,"  The octree is written to 'vxl/name.oct'.\n");
+  exit(2);
+}
+
+/** Mixes the bits of the given value (splitmix64). */
+static inline uint64_t hash(uint64_t v) {
+  v += 0x9E3779B97F4A7C15ull;
+  v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ull;
+  v = (v ^ (v >> 27)) * 0x94D049BB133111EBull;
+  return v ^ (v >> 31);
+}
+
+/** Returns a color with the given red, green and blue intensity in [0, 1), which is slightly varied by the given hash. */
+static uint32_t shade(double r, double g, double b, uint64_t h) {
+  double f = 0.9 + (h & 0xff) / 1280.0;
+  return rgb((float)(r*f*255), (float)(g*f*255), (float)(b*f*255));
+}
+
+/** A solid block in the center of the volume. */
+struct block {
+  uint32_t min, max;
+  uint64_t seed;
+  block(int depth, double density, uint64_t seed) : seed(seed) {
+    uint32_t size = 1u<<depth;
+    uint32_t side = std::max(1.0, floor(size * cbrt(density) + 0.5));
+    min = (size - side) / 2;
+    max = min + side;
+  }
+  bool overlaps(uint32_t x, uint32_t y, uint32_t z, int level) const {
+    uint32_t s = 1u<<level;
+    return x < max && x+s > min && y < max && y+s > min && z < max && z+s > min;
+  }
+  bool voxel(uint32_t x, uint32_t y, uint32_t z, uint32_t& color) const {
+    double side = max - min;
+    color = shade((x-min)/side, (y-min)/side, (z-min)/side, hash(morton3d(z, y, x) ^ seed));
+    return true;
+  }
+};
+
+/** 
+ * A Menger sponge, stretched to fill the volume. 
+ * A voxel is removed if at some level of the sponge at least two of its coordinates lie in the middle third.
+ */
+struct sponge {
+  int depth, levels;
+  uint64_t size; /// Width of the sponge, 3^levels.
+  uint64_t seed;
+  sponge(int depth, double density, uint64_t seed) : depth(depth), levels(0), size(1), seed(seed) {
+    while (size*3 <= (1ull<<depth) && pow(20/27.0, levels+1) >= density) {
+      levels++;
+      size *= 3;
+    }
+  }
+  /** Maps a voxel coordinate to the coordinate of the sponge. */
+  uint64_t map(uint64_t v) const {return v * size >> depth;}
+  /** Returns whether the range [a, b] of sponge coordinates lies within the middle third at the level with width w. */
+  static bool middle(uint64_t a, uint64_t b, uint64_t w) {
+    return a/w == b/w && a/w%3 == 1;
+  }
+  bool overlaps(uint32_t x, uint32_t y, uint32_t z, int level) const {
+    uint32_t s = (1u<<level) - 1;
+    uint64_t x0 = map(x), x1 = map(x+s), y0 = map(y), y1 = map(y+s), z0 = map(z), z1 = map(z+s);
+    for (uint64_t w = size/3; w > 0; w /= 3) {
+      if (middle(x0, x1, w) + middle(y0, y1, w) + middle(z0, z1, w) >= 2) return false;
+    }
+    return true;
+  }
+  bool voxel(uint32_t x, uint32_t y, uint32_t z, uint32_t& color) const {
+    if (!overlaps(x, y, z, 0)) return false;
+    double n = 1u<<depth;
+    color = shade(x/n, y/n, z/n, hash(morton3d(z, y, x) ^ seed));
+    return true;
+  }
+};
+
+/**
+ * A terrain, of which the height is given by the sum of several octaves of value noise.
+ * Each column is filled down to the height of its lowest neighbor, such that the surface has no holes.
+ * The minimum and maximum heights are stored for the columns of every node, to skip empty nodes quickly.
+ */
+struct terrain {
+  int depth;
+  uint32_t base, relief;
+  uint64_t seed;
+  std::vector<std::vector<uint32_t> > low, high; /// Range of filled heights per layer, indexed by x + z*width.
+  /** Returns the value noise at the given position of the lattice with the given period, in [0, 1). */
+  double noise(uint32_t x, uint32_t z, uint32_t period, int octave) const {
+    uint32_t ix = x / period, iz = z / period;
+    double fx = (x % period) / (double)period, fz = (z % period) / (double)period;
+    fx = fx*fx*(3-2*fx);
+    fz = fz*fz*(3-2*fz);
+    double v[4];
+    for (int k=0; k<4; k++) {
+      uint64_t h = hash(seed ^ hash((uint64_t)octave<<48 ^ (uint64_t)(ix + (k&1))<<24 ^ (iz + (k>>1))));
+      v[k] = (h >> 11) / 9007199254740992.0;
+    }
+    return (v[0]*(1-fx) + v[1]*fx)*(1-fz) + (v[2]*(1-fx) + v[3]*fx)*fz;
+  }
+  terrain(int depth, double density, uint64_t seed) : depth(depth), seed(seed), low(depth+1), high(depth+1) {
+    uint32_t size = 1u<<depth;
+    relief = std::max(1.0, floor(size * std::min(density, 1.0)));
+    base = (size - relief) / 2;
+    std::vector<uint32_t> height(size*size);
+    for (uint32_t z=0; z<size; z++) {
+      for (uint32_t x=0; x<size; x++) {
+        double sum = 0, weight = 0, amplitude = 1;
+        int octave = 0;
+        for (uint32_t period = std::max(size/4, 2u); period >= 2; period /= 2, amplitude /= 2, octave++) {
+          sum += noise(x, z, period, octave) * amplitude;
+          weight += amplitude;
+        }
+        height[x + z*size] = base + std::min(relief-1, (uint32_t)(sum / weight * relief));
+      }
+    }
+    low[0].resize(size*size);
+    high[0] = height;
+    for (uint32_t z=0; z<size; z++) {
+      for (uint32_t x=0; x<size; x++) {
+        uint32_t h = height[x + z*size];
+        uint32_t n = h;
+        if (x > 0) n = std::min(n, height[x-1 + z*size]);
+        if (x+1 < size) n = std::min(n, height[x+1 + z*size]);
+        if (z > 0) n = std::min(n, height[x + (z-1)*size]);
+        if (z+1 < size) n = std::min(n, height[x + (z+1)*size]);
+        low[0][x + z*size] = std::min(h, n+1);
+      }
+    }
+    for (int l=1; l<=depth; l++) {
+      uint32_t w = size>>l;
+      low[l].resize(w*w);
+      high[l].resize(w*w);
+      for (uint32_t z=0; z<w; z++) {
+        for (uint32_t x=0; x<w; x++) {
+          uint32_t i = 2*x + 4*z*w, j = i + 2*w;
+          low[l][x + z*w] = std::min(std::min(low[l-1][i], low[l-1][i+1]), std::min(low[l-1][j], low[l-1][j+1]));
+          high[l][x + z*w] = std::max(std::max(high[l-1][i], high[l-1][i+1]), std::max(high[l-1][j], high[l-1][j+1]));
+        }
+      }
+    }
+  }
+  bool overlaps(uint32_t x, uint32_t y, uint32_t z, int level) const {
+    uint32_t i = (x>>level) + (z>>level << (depth-level));
+    return y <= high[level][i] && y + (1u<<level) > low[level][i];
+  }
+  bool voxel(uint32_t x, uint32_t y, uint32_t z, uint32_t& color) const {
+    if (!overlaps(x, y, z, 0)) return false;
+    double t = (y - base) / (double)relief;
+    uint64_t h = hash(morton3d(z, y, x) ^ seed);
+    if (t < 0.4) {
+      color = shade(0.25, 0.5 + t/2, 0.15, h);
+    } else if (t < 0.75) {
+      color = shade(0.45, 0.35, 0.2, h);
+    } else {
+      color = shade(0.95, 0.95, 0.95, h);
+    }
+    return true;
+  }
+};
+
+/** Adds the voxels of the scene within the node at the given position and level, in Morton order. */
+template<class Scene> static void generate(const Scene& s, octree_builder& out, uint32_t x, uint32_t y, uint32_t z, int level) {
+  if (!s.overlaps(x, y, z, level)) return;
+  if (level == 0) {
+    uint32_t color;
+    if (s.voxel(x, y, z, color)) out.add(morton3d(z, y, x), color);
+    return;
+  }
+  uint32_t h = 1u<<(level-1);
+  for (int k=0; k<8; k++) {
+    generate(s, out, x + (k>>2&1)*h, y + (k>>1&1)*h, z + (k&1)*h, level-1);
+  }
+}
+
+/** Adds random voxels, which are sorted in Morton order first. */
+static void generate_cloud(Timer& t, octree_builder& out, int depth, double density, uint64_t seed) {
+  double volume = pow(2.0, 3*depth);
+  double count = floor(volume * density + 0.5);
+  if (count > (1<<28)) {
+    fprintf(stderr, "A cloud of %.0f voxels is too large, use a lower density.\n", count);
+    exit(1);
+  }
+  printf("[%10.0f] Generating %.0f random voxels.\n", t.elapsed(), count);
+  std::vector<uint64_t> keys((uint64_t)count);
+  uint64_t mask = (1ull<<depth) - 1;
+  for (uint64_t i=0; i<keys.size(); i++) {
+    uint64_t h = hash(seed ^ hash(i));
+    keys[i] = morton3d(h>>42 & mask, h>>21 & mask, h & mask);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  for (uint64_t i=0; i<keys.size(); i++) {
+    out.add(keys[i], hash(keys[i] ^ seed) & 0xffffff);
+  }
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  int depth = 10;
+  double density = -1;
+  uint64_t seed = 1;
+  int bottom_layer = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r:s:b:")) != -1) {
+    switch (opt) {
+      case 'd': 
+        depth = parse_int(optarg, "depth"); 
+        if (depth<1 || depth>MAX_DEPTH) usage();
+        break;
+      case 'r': 
+        density = parse_double(optarg, "density"); 
+        if (density<0 || density>1) usage();
+        break;
+      case 's': seed = strtoull(optarg, NULL, 10); break;
+      case 'b': 
+        bottom_layer = parse_int(optarg, "number of pruned layers"); 
+        if (bottom_layer<0 || bottom_layer>=depth) usage();
+        break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 3) usage();
+  const char * type = argv[1];
+  
+  // Determine the file names.
+  char * name = argv[2];
+  char outfile[strlen(name)+9];
+  sprintf(outfile, "vxl/%s.oct", name);
+
+  octree_builder out(outfile, bottom_layer);
+  if (!strcmp(type, "block")) {
+    block s(depth, density<0 ? 1 : density, seed);
+    printf("[%10.0f] Generating a block of %u voxels wide.\n", t.elapsed(), s.max - s.min);
+    generate(s, out, 0, 0, 0, depth);
+  } else if (!strcmp(type, "cloud")) {
+    generate_cloud(t, out, depth, density<0 ? 0.001 : density, seed);
+  } else if (!strcmp(type, "sponge")) {
+    sponge s(depth, density<0 ? 0 : density, seed);
+    printf("[%10.0f] Generating a Menger sponge with %d levels.\n", t.elapsed(), s.levels);
+    generate(s, out, 0, 0, 0, depth);
+  } else if (!strcmp(type, "terrain")) {
+    if (depth > 13) {
+      fprintf(stderr, "The depth of a terrain is limited to 13.\n");
+      exit(1);
+    }
+    printf("[%10.0f] Computing the heights of %u columns.\n", t.elapsed(), 1u<<2*depth);
+    terrain s(depth, density<0 ? 0.25 : density, seed);
+    printf("[%10.0f] Generating a terrain with a relief of %u voxels.\n", t.elapsed(), s.relief);
+    generate(s, out, 0, 0, 0, depth);
+  } else {
+    fprintf(stderr, "Unknown type of scene: '%s'.\n", type);
+    usage();
+  }
+  int layers = out.finish();
+  printf("[%10.0f] Wrote %lu voxels in %d layers as %u nodes (%luMiB) to '%s'.\n", t.elapsed(), out.points, layers, out.out.nodes, out.out.nodes*sizeof(octree)>>20, outfile);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -18,11 +18,29 @@
 
 #include <cstdio>
 #include <cassert>
+#include <cstring>
 #include <algorithm>
+#include <vector>
 #include <SDL/SDL_image.h>
 #include <unistd.h>
+
 #include "pointset.h"
-#include "errno.h"
+#include "octree.h"
+#include "morton.h"
+#include "parallel.h"
+#include "timing.h"
+#include "options.h"
+
+/* Converts a texture and a heightmap into a pointset, or directly into an octree.
+ *
+ * The images are upsampled by bilinear interpolation, such that each pixel becomes 2x2 columns.
+ * Each column contains the points from its height down to just above the lowest of its 4 neighbours.
+ *
+ * The pointset is written in row-major order, with bands of rows being sampled in parallel.
+ * When the octree is built directly, the columns are generated in blocks, which are sorted in Morton order.
+ * The blocks are at least as large as the height of the terrain, such that they can be added in Morton order
+ * without sorting all points.
+ */
 
 SDL_PixelFormat fmt = {
   NULL,
@@ -35,78 +53,239 @@ SDL_PixelFormat fmt = {
   0
 };
 
+static const int SUB = 2; /// Number of bits of subpixel precision of the interpolation.
+static const int P = 1<<SUB;
+static const int MASK = P-1;
+static const int DS = 2; /// Step in subpixels between consecutive columns.
+static const int BAND = 64; /// Number of rows sampled by a single task.
+
 bool checkfile(char * buffer, const char * format, const char * name) __attribute__ ((format (printf, 2, 0)));
 bool checkfile(char * buffer, const char * format, const char * name) {
   sprintf(buffer, format, name);
   return !access(buffer, F_OK);
 }
 
-uint32_t sample(SDL_Surface* s, int x, int y) {
-  return ((int*)s->pixels)[
-    (x+s->w)%s->w +
-    (y+s->h)%s->h * s->w
-  ];
+/** The input images, which have the same size. */
+struct terrain {
+  const uint32_t * texture;
+  const uint32_t * height;
+  int w, h;
+  int hrp; /// Height reduction power.
+};
+
+/** Wraps the given coordinate around the given size, which allows coordinates in [-size, 2*size). */
+static inline int wrap(int v, int size) {
+  return (v+size)%size;
 }
 
-int subsample(int c1, int c2, int c3, int c4, int x, int y) {
-  static const int SUB = 2;
-  static const int P = 1<<SUB;
-  return ((c1*(P-x)+c2*x)*(P-y) + (c3*(P-x)+c4*x)*y) >> SUB >> SUB;
+/**
+ * Samples the height and color of the columns in the given rectangle, in row-major order. 
+ * Colors are only sampled if a color buffer is given.
+ * Coordinates outside of the images wrap around.
+ */
+static void sample_region(const terrain& m, int x0, int y0, int nx, int ny, uint32_t * height, uint32_t * color) {
+  static const uint32_t M1 = 0xff0000;
+  static const uint32_t M2 = 0x00ff00;
+  static const uint32_t M3 = 0x0000ff;
+  std::vector<int> left(nx), right(nx), fx(nx);
+  for (int i=0; i<nx; i++) {
+    int x = (x0+i)*DS;
+    left[i] = wrap(x>>SUB, m.w);
+    right[i] = wrap((x>>SUB)+1, m.w);
+    fx[i] = x&MASK;
+  }
+  for (int j=0; j<ny; j++) {
+    int y = (y0+j)*DS;
+    uint32_t fy = y&MASK;
+    int top = wrap(y>>SUB, m.h)*m.w;
+    int bottom = wrap((y>>SUB)+1, m.h)*m.w;
+    const uint32_t * h1 = m.height + top;
+    const uint32_t * h2 = m.height + bottom;
+    uint32_t * out = height + j*nx;
+    for (int i=0; i<nx; i++) {
+      uint32_t c1 = h1[left[i]]&0xff, c2 = h1[right[i]]&0xff;
+      uint32_t c3 = h2[left[i]]&0xff, c4 = h2[right[i]]&0xff;
+      uint32_t f = fx[i];
+      out[i] = ((c1*(P-f)+c2*f)*(P-fy) + (c3*(P-f)+c4*f)*fy) >> m.hrp;
+    }
+    if (!color) continue;
+    const uint32_t * t1 = m.texture + top;
+    const uint32_t * t2 = m.texture + bottom;
+    uint32_t * cout = color + j*nx;
+    for (int i=0; i<nx; i++) {
+      uint32_t c1 = t1[left[i]], c2 = t1[right[i]];
+      uint32_t c3 = t2[left[i]], c4 = t2[right[i]];
+      uint32_t f = fx[i];
+      cout[i] =
+        ((((c1&M1)*(P-f)+(c2&M1)*f)*(P-fy) + ((c3&M1)*(P-f)+(c4&M1)*f)*fy) >> SUB >> SUB & M1) |
+        ((((c1&M2)*(P-f)+(c2&M2)*f)*(P-fy) + ((c3&M2)*(P-f)+(c4&M2)*f)*fy) >> SUB >> SUB & M2) |
+        ((((c1&M3)*(P-f)+(c2&M3)*f)*(P-fy) + ((c3&M3)*(P-f)+(c4&M3)*f)*fy) >> SUB >> SUB & M3);
+    }
+  }
 }
 
-uint32_t subsample_color(SDL_Surface* s, int x, int y) {
-  static const int SUB = 2;
-  static const int MASK = (1<<SUB)-1;
-  static const int M1 = 0xff0000;
-  static const int M2 = 0x00ff00;
-  static const int M3 = 0x0000ff;
-  
-  int x1 = x>>SUB, x2 = x&MASK;
-  int y1 = y>>SUB, y2 = y&MASK;
-  uint32_t c1 = sample(s,x1,  y1);
-  uint32_t c2 = sample(s,x1+1,y1);
-  uint32_t c3 = sample(s,x1,  y1+1);
-  uint32_t c4 = sample(s,x1+1,y1+1);
-  
-  uint32_t r =
-    (subsample(c1&M1,c2&M1,c3&M1,c4&M1,x2,y2)&M1) |
-    (subsample(c1&M2,c2&M2,c3&M2,c4&M2,x2,y2)&M2) |
-    (subsample(c1&M3,c2&M3,c3&M3,c4&M3,x2,y2)&M3);
-  assert(x2 || y2 || r==(c1&0xffffff));
-  return r;
+/** 
+ * Generates the columns in the given rectangle, calling out(x, y, z, color) for each point.
+ * The columns are generated in row-major order, from the top of the column downwards.
+ */
+template<class Out> static void generate(const terrain& m, int x0, int y0, int nx, int ny, Out& out) {
+  // Sample the rectangle with a border of one column, for the neighbours.
+  int sx = nx+2, sy = ny+2;
+  std::vector<uint32_t> height(sx*sy), color(sx*sy);
+  sample_region(m, x0-1, y0-1, sx, sy, &height[0], &color[0]);
+  for (int j=1; j<=ny; j++) {
+    const uint32_t * row = &height[j*sx];
+    for (int i=1; i<=nx; i++) {
+      uint32_t c = color[j*sx+i];
+      uint32_t z = row[i];
+      out(x0+i-1, z, y0+j-1, c);
+      uint32_t n = std::min(std::min(row[i-1], row[i+1]), std::min(row[i-sx], row[i+sx]));
+      for (uint32_t k=n+1; k<z; k++) {
+        out(x0+i-1, k, y0+j-1, c);
+      }
+    }
+  }
 }
 
-uint32_t subsample_height(SDL_Surface* s, int x, int y) {
-  static const int SUB = 2;
-  static const int P = 1<<SUB;
-  static const int MASK = P-1;
-  static const int M = 0xff;
-  
-  int x1 = x>>SUB, x2 = x&MASK;
-  int y1 = y>>SUB, y2 = y&MASK;
-  uint32_t c1 = sample(s,x1,  y1)&M;
-  uint32_t c2 = sample(s,x1+1,y1)&M;
-  uint32_t c3 = sample(s,x1,  y1+1)&M;
-  uint32_t c4 = sample(s,x1+1,y1+1)&M;
-  
-  uint32_t r = (c1*(P-x2)+c2*x2)*(P-y2) + (c3*(P-x2)+c4*x2)*y2;
-  assert(x2 || y2 || (r>>4==c1));
-  return r;
+/** Collects the points of a band of rows. */
+struct point_list {
+  std::vector<point> points;
+  void operator()(uint32_t x, uint32_t y, uint32_t z, uint32_t c) {
+    points.push_back(point(x, y, z, c));
+  }
+};
+
+/** A point, given by its Morton key. */
+struct voxel {
+  uint64_t key;
+  uint32_t color;
+  bool operator<(const voxel& v) const {return key < v.key;}
+};
+
+/** Collects the points of a block by their Morton keys. */
+struct voxel_list {
+  std::vector<voxel> voxels;
+  void operator()(uint32_t x, uint32_t y, uint32_t z, uint32_t c) {
+    voxel v = {morton3d(z, y, x), c};
+    voxels.push_back(v);
+  }
+};
+
+struct job {
+  const terrain * m;
+  int columns, rows; /// Size of the output grid.
+  uint64_t first; /// First task of the current batch.
+  int block_bits; /// Size of a block as power of 2.
+  std::vector<point_list> bands;
+  std::vector<voxel_list> blocks;
+};
+
+static void band_task(uint64_t i, void * data) {
+  job& j = *(job*)data;
+  point_list& out = j.bands[i];
+  out.points.clear();
+  int y0 = (j.first + i) * BAND;
+  generate(*j.m, 0, y0, j.columns, std::min(BAND, j.rows - y0), out);
+}
+
+/** Returns the coordinates of the given block, which are interleaved with the x coordinate in the higher bit. */
+static void block_position(uint64_t block, int& x, int& y) {
+  x = y = 0;
+  for (int b=0; b<32; b++) {
+    x |= (block >> (2*b+1) & 1) << b;
+    y |= (block >> (2*b) & 1) << b;
+  }
+}
+
+static void block_task(uint64_t i, void * data) {
+  job& j = *(job*)data;
+  voxel_list& out = j.blocks[i];
+  out.voxels.clear();
+  int x, y;
+  block_position(j.first + i, x, y);
+  int size = 1<<j.block_bits;
+  x <<= j.block_bits;
+  y <<= j.block_bits;
+  if (x >= j.columns || y >= j.rows) return;
+  generate(*j.m, x, y, std::min(size, j.columns - x), std::min(size, j.rows - y), out);
+  std::sort(out.voxels.begin(), out.voxels.end());
+}
+
+/** Writes the points to the pointset, in row-major order. */
+static void write_pointset(Timer& t, job& j, int threads, const char * outfile) {
+  pointfile out(outfile);
+  uint64_t points = 0;
+  uint64_t bands = (j.rows + BAND - 1) / BAND;
+  for (j.first = 0; j.first < bands; j.first += j.bands.size()) {
+    j.bands.resize(std::min<uint64_t>(threads*4, bands - j.first));
+    parallel_for(threads, j.bands.size(), band_task, &j);
+    for (uint64_t i=0; i<j.bands.size(); i++) {
+      const std::vector<point>& list = j.bands[i].points;
+      for (uint64_t k=0; k<list.size(); k++) out.add(list[k]);
+      points += list.size();
+    }
+  }
+  printf("[%10.0f] Wrote %lu points to '%s'.\n", t.elapsed(), points, outfile);
+}
+
+/** Builds the octree, adding the blocks in Morton order. */
+static void write_octree(Timer& t, job& j, int threads, const char * outfile, uint32_t max_height) {
+  // The height must fit in a block, such that the blocks do not overlap in Morton order.
+  j.block_bits = 6;
+  while ((1u<<j.block_bits) <= max_height) j.block_bits++;
+  int grid = 1<<j.block_bits;
+  while (grid < j.columns || grid < j.rows) grid *= 2;
+  uint64_t blocks = (uint64_t)(grid>>j.block_bits) * (grid>>j.block_bits);
+  printf("[%10.0f] Building octree from %lu blocks of %dx%d columns.\n", t.elapsed(), blocks, 1<<j.block_bits, 1<<j.block_bits);
+  octree_builder out(outfile);
+  for (j.first = 0; j.first < blocks; j.first += j.blocks.size()) {
+    j.blocks.resize(std::min<uint64_t>(threads, blocks - j.first));
+    parallel_for(threads, j.blocks.size(), block_task, &j);
+    for (uint64_t i=0; i<j.blocks.size(); i++) {
+      const std::vector<voxel>& list = j.blocks[i].voxels;
+      for (uint64_t k=0; k<list.size(); k++) out.add(list[k].key, list[k].color);
+    }
+  }
+  int layers = out.finish();
+  printf("[%10.0f] Wrote %lu points in %d layers as %u nodes to '%s'.\n", t.elapsed(), out.points, layers, out.out.nodes, outfile);
 }
 
-int main(int argc, const char ** argv) {
-  if (argc != 3) {
-    fprintf(stderr,"Please specify the file to convert (without 'input/', '-h', '.png' or '.jpg'), followed by the height reduction power.\n");
-    exit(2);
+static void usage() {
+  fprintf(stderr,"Please specify the file to convert (without 'input/', '-h', '.png' or '.jpg'), followed by the height reduction power.\n");
+  fprintf(stderr,"Usage: heightmap [-o | -c] [-j threads] file power\n");
+  fprintf(stderr,"  -o         Build the octree 'vxl/file.oct' directly, instead of writing a pointset.\n");
+  fprintf(stderr,"  -c         Write the points to standard output, instead of to 'vxl/file.vxl'.\n");
+  fprintf(stderr,"  -j threads Number of threads to use (default: all processors).\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  bool octree_output = false;
+  bool to_stdout = false;
+  int threads = processor_count();
+  int opt;
+  while ((opt = getopt(argc, argv, "ocj:")) != -1) {
+    switch (opt) {
+      case 'o': octree_output = true; break;
+      case 'c': to_stdout = true; break;
+      case 'j':
+        threads = parse_int(optarg, "number of threads");
+        if (threads<=0) threads = processor_count();
+        break;
+      default: usage();
+    }
   }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 3 || (octree_output && to_stdout)) usage();
 
   // Determine height reduction power.
-  char * endptr = NULL;
-  const int hrp = strtol(argv[2], &endptr, 10);
-  if (errno) {perror("Could not parse height reduction power"); exit(1);}
-  assert(endptr);
-  assert(endptr[0]==0);
-  assert(hrp>=0 && hrp<12);
+  const int hrp = parse_int(argv[2], "height reduction power");
+  if (hrp<0 || hrp>=12) {
+    fprintf(stderr, "Height reduction power must be in the range [0,12).\n");
+    exit(1);
+  }
 
   // Determine the file names.
   const char * name = argv[1];
@@ -131,7 +310,7 @@ int main(int argc, const char ** argv) {
     fprintf(stderr,"Failed to open heightmap.\n");
     exit(1);
   }
-  sprintf(outfile, "vxl/%s.vxl", name);
+  sprintf(outfile, octree_output ? "vxl/%s.oct" : "vxl/%s.vxl", name);
   
   // Loading images
   IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
@@ -146,34 +325,29 @@ int main(int argc, const char ** argv) {
   // Preparing
   assert(texture->w==height->w);
   assert(texture->h==height->h);
-  int w=texture->w;
-  int h=texture->h;
+  terrain m;
+  m.texture = (const uint32_t*)texture->pixels;
+  m.height = (const uint32_t*)height->pixels;
+  m.w = texture->w;
+  m.h = texture->h;
+  m.hrp = hrp;
+  job j;
+  j.m = &m;
+  j.columns = m.w*P/DS;
+  j.rows = m.h*P/DS;
+
+  // The interpolated heights do not exceed the highest pixel.
+  uint32_t max_height = 0;
+  for (int i=0; i<m.w*m.h; i++) max_height = std::max(max_height, m.height[i]&0xff);
+  max_height = max_height*P*P >> hrp;
+  printf("[%10.0f] Generating %dx%d columns of at most %u points, using %d threads.\n", t.elapsed(), j.columns, j.rows, max_height+1, threads);
   
   // Write output
-  pointfile out(outfile);
-  int points = 0;
-  int maxh = 0;
-  const int ds = 2;
-  for(int y=0;y<h*4;y+=ds) {
-    for(int x=0;x<w*4;x+=ds) {
-      int c = subsample_color(texture, x, y);
-      int z = subsample_height(height, x, y)>>hrp;
-      out.add(point(x/ds,z,y/ds,c));
-      maxh = std::max(maxh, z);
-      points++;
-      int n = std::min(std::min(std::min((
-          subsample_height(height, x-ds, y)>>hrp),
-          subsample_height(height, x+ds, y)>>hrp),
-          subsample_height(height, x, y-ds)>>hrp),
-          subsample_height(height, x, y+ds)>>hrp);
-      for (int i=n+1; i<z; i++) {
-        out.add(point(x/ds,i,y/ds,c));
-        points++;
-      }
-    }
+  if (octree_output) {
+    write_octree(t, j, threads, outfile, max_height);
+  } else {
+    write_pointset(t, j, threads, to_stdout ? "-" : outfile);
   }
-  fprintf(stderr, "wrote: %dMi points\n", points>>20);
-  fprintf(stderr, "maximum height: %d\n", maxh);
 }
  
-// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
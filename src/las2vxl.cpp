@@ -0,0 +1,274 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pointset.h"
+#include "parallel.h"
+#include "morton.h"
+#include "timing.h"
+#include "voxel_grid.h"
+#include "options.h"
+
+/* Converts a binary LAS file (version 1.2 to 1.4, point format 0-3 or 6-8) to binary pointset format.
+ *
+ * The file is mapped to memory and its point records are converted in parallel.
+ * The coordinates are transformed using the scale and offset in the header
+ * and then quantized using the bounds in the header.
+ * The color is taken from the RGB values if present, and otherwise from the intensity.
+ */
+
+static const int DEFAULT_DEPTH = 20;
+static const uint64_t CHUNK = 1<<20; /// Number of records converted by a single task.
+
+/** Reads a little endian value from an unaligned position. */
+template<class T> static T get(const uint8_t * data) {
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+struct las_file {
+  const uint8_t * data;
+  uint64_t size;
+  int version;
+  int format;
+  uint32_t record_length;
+  uint64_t records;
+  uint64_t offset; /// Position of the first point record.
+  double scale[3];
+  double translate[3];
+  double min[3], max[3];
+  int rgb_offset; /// Position of the RGB values within a record, or -1 if there are none.
+};
+
+/** Parses the header of the LAS file and checks whether it is supported. */
+static void parse_header(las_file& f) {
+  static const int record_size[] = {20, 28, 26, 34, -1, -1, 30, 36, 38};
+  static const int rgb_position[] = {-1, -1, 20, 28, -1, -1, -1, 30, 30};
+  const uint8_t * h = f.data;
+  if (f.size < 227 || memcmp(h, "LASF", 4)) {
+    fprintf(stderr, "Not a LAS file.\n");
+    exit(1);
+  }
+  f.version = h[24]*10 + h[25];
+  if (f.version < 10 || f.version > 14) {
+    fprintf(stderr, "Unsupported LAS version %d.%d.\n", h[24], h[25]);
+    exit(1);
+  }
+  uint16_t header_size = get<uint16_t>(h+94);
+  f.offset = get<uint32_t>(h+96);
+  f.format = h[104];
+  f.record_length = get<uint16_t>(h+105);
+  f.records = get<uint32_t>(h+107);
+  if (f.version >= 14 && header_size >= 255 && f.size >= 255) {
+    f.records = get<uint64_t>(h+247);
+  }
+  if (f.format & 0x80) {
+    fprintf(stderr, "Compressed LAS files are not supported.\n");
+    exit(1);
+  }
+  if (f.format > 8 || record_size[f.format] < 0) {
+    fprintf(stderr, "Unsupported point data format %d.\n", f.format);
+    exit(1);
+  }
+  if ((int)f.record_length < record_size[f.format]) {
+    fprintf(stderr, "Point records of %u bytes are too small for point data format %d.\n", f.record_length, f.format);
+    exit(1);
+  }
+  if (f.offset < header_size || f.offset + f.records * f.record_length > f.size) {
+    fprintf(stderr, "File is truncated: expected %lu point records of %u bytes.\n", f.records, f.record_length);
+    exit(1);
+  }
+  f.rgb_offset = rgb_position[f.format];
+  for (int i=0; i<3; i++) {
+    f.scale[i] = get<double>(h+131+i*8);
+    f.translate[i] = get<double>(h+155+i*8);
+    f.max[i] = get<double>(h+179+i*16);
+    f.min[i] = get<double>(h+187+i*16);
+  }
+}
+
+/** Determines whether the RGB values use 16 bits, by checking a sample of the records. */
+static bool has_16bit_rgb(const las_file& f) {
+  uint64_t step = std::max<uint64_t>(1, f.records >> 16);
+  for (uint64_t i=0; i<f.records; i+=step) {
+    const uint8_t * rgb = f.data + f.offset + i*f.record_length + f.rgb_offset;
+    if ((get<uint16_t>(rgb) | get<uint16_t>(rgb+2) | get<uint16_t>(rgb+4)) > 255) return true;
+  }
+  return false;
+}
+
+struct job {
+  const las_file * f;
+  const quantization * q;
+  bool use_rgb;
+  int rgb_shift;
+  uint64_t first; /// First chunk of the current batch.
+  voxel_grid * grid; /// If not NULL, the points are merged into the grid instead.
+  std::vector<std::vector<point> > chunks;
+};
+
+static void convert_task(uint64_t i, void * data) {
+  job& j = *(job*)data;
+  const las_file& f = *j.f;
+  std::vector<point>& out = j.chunks[i];
+  uint64_t begin = (j.first + i) * CHUNK;
+  uint64_t end = std::min(f.records, begin + CHUNK);
+  out.resize(end - begin);
+  const uint8_t * record = f.data + f.offset + begin * f.record_length;
+  for (uint64_t k=0; k<end-begin; k++, record += f.record_length) {
+    // Swap the y and z axis, as LAS has z pointing up.
+    double coord[3];
+    coord[0] = get<int32_t>(record+0) * f.scale[0] + f.translate[0];
+    coord[2] = get<int32_t>(record+4) * f.scale[1] + f.translate[1];
+    coord[1] = get<int32_t>(record+8) * f.scale[2] + f.translate[2];
+    uint32_t color;
+    if (j.use_rgb) {
+      const uint8_t * rgb = record + f.rgb_offset;
+      color = (get<uint16_t>(rgb)>>j.rgb_shift)<<16 | (get<uint16_t>(rgb+2)>>j.rgb_shift)<<8 | get<uint16_t>(rgb+4)>>j.rgb_shift;
+    } else {
+      color = 0x10101 * std::min(255, get<uint16_t>(record+12)*6);
+    }
+    out[k] = j.q->apply(coord, color);
+  }
+  if (j.grid) {
+    j.grid->add(out.data(), out.size());
+    out.clear();
+  }
+}
+
+static void usage() {
+  fprintf(stderr,"Please specify the file to convert (without '.las').\n");
+  fprintf(stderr,"Usage: las2vxl [-d depth] [-s scale] [-i] [-m] [-c] [-j threads] file\n");
+  fprintf(stderr,"  -d depth   Number of bits per coordinate of the output (default: %d).\n", DEFAULT_DEPTH);
+  fprintf(stderr,"  -s scale   Number of points per unit of the input (default: fill the range of the output).\n");
+  fprintf(stderr,"  -i         Use the intensity as color, even if the points have RGB values.\n");
+  fprintf(stderr,"  -m         Merge the points in the same voxel into one point with their average color.\n");
+  fprintf(stderr,"  -c         Write the points to standard output, instead of to 'vxl/file.vxl'.\n");
+  fprintf(stderr,"  -j threads Number of threads to use (default: all processors).\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+
+  // Parse options
+  int depth = DEFAULT_DEPTH;
+  double scale = 0;
+  bool intensity = false;
+  bool merge = false;
+  bool to_stdout = false;
+  int threads = processor_count();
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:imcj:")) != -1) {
+    switch (opt) {
+      case 'd':
+        depth = parse_int(optarg, "depth");
+        if (depth<1 || depth>MAX_DEPTH) {
+          fprintf(stderr, "Depth must be in the range [1,%d].\n", MAX_DEPTH);
+          exit(1);
+        }
+        break;
+      case 's':
+        scale = parse_double(optarg, "scale");
+        if (scale<=0) {
+          fprintf(stderr, "Scale must be positive.\n");
+          exit(1);
+        }
+        break;
+      case 'i': intensity = true; break;
+      case 'm': merge = true; break;
+      case 'c': to_stdout = true; break;
+      case 'j':
+        threads = parse_int(optarg, "number of threads");
+        if (threads<=0) threads = processor_count();
+        break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2) usage();
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char infile[length+11];
+  char outfile[length+9];
+  sprintf(infile, "input/%s.las", name);
+  sprintf(outfile, "vxl/%s.vxl", name);
+
+  // Map the input file to memory.
+  int fd = open(infile, O_RDONLY);
+  if (fd == -1) {perror("Could not open file"); exit(1);}
+  las_file f;
+  f.size = lseek(fd, 0, SEEK_END);
+  if (f.size == 0) {fprintf(stderr, "Not a LAS file.\n"); exit(1);}
+  f.data = (const uint8_t*)mmap(NULL, f.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (f.data == MAP_FAILED) {perror("Could not map file to memory"); exit(1);}
+  madvise((void*)f.data, f.size, MADV_SEQUENTIAL);
+  parse_header(f);
+  printf("[%10.0f] Opened LAS %d.%d file '%s' with %lu points of format %d.\n", t.elapsed(), f.version/10, f.version%10, infile, f.records, f.format);
+
+  // Quantize using the bounds in the header, with the y and z axis swapped.
+  double min[3] = {f.min[0], f.min[2], f.min[1]};
+  double max[3] = {f.max[0], f.max[2], f.max[1]};
+  quantization q;
+  q.fit(min, max, depth, scale);
+  printf("[%10.0f] Bounds: x %f - %f, y %f - %f, z %f - %f, using scale %f.\n", t.elapsed(), f.min[0], f.max[0], f.min[1], f.max[1], f.min[2], f.max[2], q.scale);
+
+  job j;
+  j.f = &f;
+  j.q = &q;
+  voxel_grid * grid = merge ? new voxel_grid() : NULL;
+  j.grid = grid;
+  j.use_rgb = f.rgb_offset >= 0 && !intensity;
+  j.rgb_shift = j.use_rgb && has_16bit_rgb(f) ? 8 : 0;
+  printf("[%10.0f] Using %s as color.\n", t.elapsed(), j.use_rgb ? (j.rgb_shift ? "16-bit RGB" : "8-bit RGB") : "intensity");
+
+  // Convert the points in batches of a few chunks per thread, writing them in order.
+  pointfile out(to_stdout ? "-" : outfile);
+  uint64_t chunks = (f.records + CHUNK - 1) / CHUNK;
+  for (j.first = 0; j.first < chunks; j.first += j.chunks.size()) {
+    j.chunks.resize(std::min<uint64_t>(threads*4, chunks - j.first));
+    parallel_for(threads, j.chunks.size(), convert_task, &j);
+    for (uint64_t i=0; i<j.chunks.size(); i++) {
+      for (uint64_t k=0; k<j.chunks[i].size(); k++) out.add(j.chunks[i][k]);
+    }
+    uint64_t done = std::min(f.records, (j.first + j.chunks.size()) * CHUNK);
+    printf("[%10.0f] Converted %lu of %lu points.\n", t.elapsed(), done, f.records);
+  }
+  if (grid) {
+    printf("[%10.0f] Merged %lu points into %lu voxels.\n", t.elapsed(), grid->points(), grid->size());
+    grid->write(out, threads);
+    delete grid;
+  }
+  q.write(outfile);
+  munmap((void*)f.data, f.size);
+  close(fd);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
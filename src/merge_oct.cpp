@@ -0,0 +1,219 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <unistd.h>
+
+#include "octree.h"
+#include "morton.h"
+#include "timing.h"
+
+/* Merges a source octree into a target octree, such that the target contains the voxels of both.
+ *
+ * The octrees are traversed in lockstep, only descending where both contain a node.
+ * Subtrees that occur only in the target are kept as they are. Subtrees that occur only in the source
+ * are copied, and the merged nodes are created along the paths where both contain a node.
+ * These nodes are appended to the target file, after which its root is replaced.
+ * Hence the cost is proportional to the size of the source plus the overlap of both octrees, 
+ * regardless of the size of the target, and the larger octree should be the target. 
+ * The target nodes along the merged paths are replaced and remain in the file, no longer referenced.
+ *
+ * Both octrees must use the same coordinates and number of pruned layers.
+ * If one of them has fewer layers, it is located at the origin of the other.
+ *
+ * The octrees are read from '.oct64' files if their '.oct' file does not exist. 
+ * At most one node is appended per source node, plus the nodes added above the shallower octree. 
+ * If the target might then exceed 32-bit indices, it is first converted to a '.oct64' file.
+ */
+
+/** Nodes of either octree, including those that are added above the shallower one. */
+struct tree_nodes {
+  const octree_file * file;
+  std::map<uint64_t, octree64> added; /// Nodes that are not read from the file.
+  octree64 get(uint64_t index) const {
+    std::map<uint64_t, octree64>::const_iterator it = added.find(index);
+    return it == added.end() ? file->node(index) : it->second;
+  }
+};
+
+static uint64_t merged = 0;
+static uint64_t collisions = 0;
+
+/** Mixes the colors of two leaves that contain the same voxel. */
+static int32_t mix(int32_t a, int32_t b) {
+  color_sum sum;
+  sum.add(a);
+  sum.add(b);
+  return sum.average();
+}
+
+/** 
+ * Appends the subtree of the source with the given root to the target and returns the index of its copy.
+ * Children that are shared due to repetition are copied once.
+ */
+static uint64_t copy(octree_writer& out, const tree_nodes& source, uint64_t index) {
+  octree64 n = source.get(index);
+  octree64 m = n;
+  for (int i=0; i<8; i++) {
+    if (!~n.child[i]) continue;
+    int j=0;
+    while (n.child[j] != n.child[i]) j++;
+    m.child[i] = j<i ? m.child[j] : copy(out, source, n.child[i]);
+  }
+  return out.add(m);
+}
+
+/** Merges the given nodes of the target and the source. The new nodes below the merged node are appended to the target. */
+static octree64 merge(octree_writer& out, const tree_nodes& target, const tree_nodes& source, const octree64& a, const octree64& b) {
+  octree64 n;
+  merged++;
+  for (int i=0; i<8; i++) {
+    bool has_a = a.avgcolor[i]>=0;
+    bool has_b = b.avgcolor[i]>=0;
+    if (!has_b || (has_a && ~a.child[i] && !~b.child[i])) {
+      // Only the target contains this child, or the source contains a leaf where the target contains a node.
+      n.child[i] = a.child[i];
+      n.avgcolor[i] = a.avgcolor[i];
+    } else if (!has_a || !~a.child[i]) {
+      if (has_a && !~b.child[i]) {
+        // Both contain a leaf.
+        n.child[i] = ~(uint64_t)0;
+        n.avgcolor[i] = mix(a.avgcolor[i], b.avgcolor[i]);
+        collisions++;
+      } else {
+        // Only the source contains this child, or the target contains a leaf where the source contains a node.
+        n.child[i] = ~b.child[i] ? copy(out, source, b.child[i]) : ~(uint64_t)0;
+        n.avgcolor[i] = b.avgcolor[i];
+      }
+    } else {
+      octree64 m = merge(out, target, source, target.get(a.child[i]), source.get(b.child[i]));
+      n.avgcolor[i] = average(m);
+      n.child[i] = out.add(m);
+    }
+  }
+  return n;
+}
+
+/**
+ * Adds nodes above the root of the octree, such that it has the given number of layers, and returns the new root.
+ * The nodes are given the indices that follow next, which are those of the output for the target.
+ */
+static octree64 extend(tree_nodes& tree, uint64_t& next, int layers, int depth) {
+  octree64 n = tree.get(0);
+  for (int l=layers; l<depth; l++) {
+    octree64 up;
+    clear(up);
+    up.avgcolor[0] = average(n);
+    up.child[0] = next++;
+    tree.added[up.child[0]] = n;
+    n = up;
+  }
+  return n;
+}
+
+/** Determines the name of an octree file, which has 64-bit indices if its '.oct' file does not exist. */
+static void octree_name(char * file, const char * name) {
+  sprintf(file, "vxl/%s.oct", name);
+  if (access(file, F_OK)) sprintf(file, "vxl/%s.oct64", name);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  if (argc != 3) {
+    fprintf(stderr,"Please specify the octree to merge into and the octree to merge (without '.oct').\n");
+    fprintf(stderr,"Usage: merge_oct target source\n");
+    exit(2);
+  }
+
+  // Determine the file names.
+  char a_file[strlen(argv[1])+11];
+  char b_file[strlen(argv[2])+11];
+  octree_name(a_file, argv[1]);
+  octree_name(b_file, argv[2]);
+  if (!strcmp(argv[1], argv[2])) {
+    fprintf(stderr,"The source must differ from the target.\n");
+    exit(1);
+  }
+
+  tree_nodes source;
+  octree_file b(b_file);
+  source.file = &b;
+  uint64_t b_nodes = b.nodes();
+  int b_depth = b.wide ? octree_depth(b.root64, b_nodes) : octree_depth(b.root, b_nodes);
+  uint64_t a_nodes;
+  int a_depth;
+  {
+    octree_file a(a_file);
+    a_nodes = a.nodes();
+    a_depth = a.wide ? octree_depth(a.root64, a_nodes) : octree_depth(a.root, a_nodes);
+    printf("[%10.0f] Merging '%s' (%lu nodes, %d layers) into '%s' (%lu nodes, %d layers).\n", t.elapsed(), b_file, b_nodes, b_depth, a_file, a_nodes, a_depth);
+    int a_pruned = read_pruned_layers(a_file);
+    int b_pruned = read_pruned_layers(b_file);
+    if (a_pruned >= 0 && b_pruned >= 0 && a_pruned != b_pruned) {
+      fprintf(stderr, "The octrees were built with %d and %d pruned layers.\n", a_pruned, b_pruned);
+      exit(1);
+    }
+    
+    // Convert the target to 64-bit indices if the appended nodes might not fit.
+    if (!a.wide && a_nodes + b_nodes + D >= ~0u) {
+      char wide_file[strlen(a_file)+3];
+      sprintf(wide_file, "%s64", a_file);
+      printf("[%10.0f] Converting '%s' to '%s'.\n", t.elapsed(), a_file, wide_file);
+      {
+        octree_writer out(wide_file);
+        for (uint64_t i=1; i<a_nodes; i++) out.add(a.node(i));
+        out.set_root(a.node(0));
+      }
+      if (unlink(a_file)) {perror("Could not remove converted octree"); exit(1);}
+      if (a_pruned >= 0) {
+        write_pruned_layers(wide_file, a_pruned);
+        char meta[strlen(a_file)+6];
+        sprintf(meta, "%s.meta", a_file);
+        unlink(meta);
+      }
+      strcpy(a_file, wide_file);
+    }
+  }
+  octree_file a(a_file);
+  tree_nodes target;
+  target.file = &a;
+
+  // Add layers above the shallower octree, where an empty octree is considered to have any depth.
+  octree_writer out(a_file, true);
+  assert(out.nodes == a_nodes);
+  int depth = std::max(a_depth, b_depth);
+  uint64_t next = a_nodes;
+  octree64 a_root = a_depth ? extend(target, next, a_depth, depth) : a.node(0);
+  for (uint64_t i=a_nodes; i<next; i++) out.add(target.added[i]);
+  next = b_nodes;
+  octree64 b_root = b_depth ? extend(source, next, b_depth, depth) : b.node(0);
+
+  // Merge the octrees. The root is replaced once the other nodes are written.
+  octree64 root = merge(out, target, source, a_root, b_root);
+  out.flush();
+  out.set_root(root);
+  printf("[%10.0f] Merged %lu nodes, with %lu colliding voxels.\n", t.elapsed(), merged, collisions);
+  printf("[%10.0f] Appended %lu nodes of %luB each (%luMiB).\n", t.elapsed(), out.nodes - a_nodes, a.wide ? sizeof(octree64) : sizeof(octree), (out.nodes - a_nodes)*(a.wide ? sizeof(octree64) : sizeof(octree))>>20);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
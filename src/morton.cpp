@@ -0,0 +1,100 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "morton.h"
+
+static const uint64_t B[] = {
+  0xFFFF00000000FFFF, 
+  0x00FF0000FF0000FF, 
+  0xF00F00F00F00F00F, 
+  0x30C30C30C30C30C3, 
+  0x9249249249249249,
+};
+static const uint64_t S[] = {32, 16, 8, 4, 2};
+    
+uint64_t morton3d( uint64_t x, uint64_t y, uint64_t z ) {   
+  // pack 3 32-bit indices into a 96-bit Morton code
+  // except that the result is truncated to 64-bit.
+  for (uint64_t i=0; i<5; i++) {
+    x = (x | (x << S[i])) & B[i];
+    y = (y | (y << S[i])) & B[i];
+    z = (z | (z << S[i])) & B[i];
+  }
+  return x | (y<<1) | (z<<2);
+}
+
+void morton3d_inverse( uint64_t v, uint32_t & x, uint32_t & y, uint32_t & z ) {
+  // unpack the 21 bits of each index, inverse of morton3d.
+  uint64_t c[3] = {v, v>>1, v>>2};
+  for (int j=0; j<3; j++) {
+    c[j] &= B[4];
+    for (int i=4; i>0; i--) {
+      c[j] = (c[j] | (c[j] >> S[i])) & B[i-1];
+    }
+    c[j] = (c[j] | (c[j] >> S[0])) & 0x1FFFFF;
+  }
+  x = c[0]; y = c[1]; z = c[2];
+}
+
+uint64_t hilbert3d( const point & p ) {
+  uint64_t val = morton3d( p.x,p.y,p.z );
+  uint64_t start = 0;
+  uint64_t end = 1; // can be 1,2,4
+  uint64_t ret = 0;
+  for (int64_t j=19; j>=0; j--) {
+    uint64_t rg = ((val>>(3*j))&7) ^ start;
+    uint64_t travel_shift = (0x30210 >> (start ^ end)*4)&3;
+    uint64_t i = (((rg << 3) | rg) >> travel_shift ) & 7;
+    i = (0x54672310 >> i*4) & 7;
+    ret = (ret<<3) | i;
+    uint64_t si = (0x64422000 >> i*4 ) & 7; // next lower even number, or 0
+    uint64_t ei = (0x77755331 >> i*4 ) & 7; // next higher odd number, or 7
+    uint64_t sg = ( si ^ (si>>1) ) << travel_shift;
+    uint64_t eg = ( ei ^ (ei>>1) ) << travel_shift;
+    end   = ( ( eg | ( eg >> 3 ) ) & 7 ) ^ start;
+    start = ( ( sg | ( sg >> 3 ) ) & 7 ) ^ start;
+  }
+  return ret;
+}
+    
+bool hilbert3d_compare( const point & p1,const point & p2 ) {
+  uint64_t val1 = morton3d( p1.x,p1.y,p1.z );
+  uint64_t val2 = morton3d( p2.x,p2.y,p2.z );
+  uint64_t start = 0;
+  uint64_t end = 1; // can be 1,2,4
+  for (int64_t j=19; j>=0; j--) {
+    uint64_t travel_shift = (0x30210 >> (start ^ end)*4)&3;
+    uint64_t rg1 = ((val1>>(3*j))&7) ^ start;
+    uint64_t rg2 = ((val2>>(3*j))&7) ^ start;
+    uint64_t i1 = (((rg1 << 3) | rg1) >> travel_shift ) & 7;
+    uint64_t i2 = (((rg2 << 3) | rg2) >> travel_shift ) & 7;
+    i1 = (0x54672310 >> i1*4) & 7;
+    i2 = (0x54672310 >> i2*4) & 7;
+    if (i1<i2) return true;
+    if (i1>i2) return false;
+    uint64_t si = (0x64422000 >> i1*4 ) & 7; // next lower even number, or 0
+    uint64_t ei = (0x77755331 >> i1*4 ) & 7; // next higher odd number, or 7
+    uint64_t sg = ( si ^ (si>>1) ) << travel_shift;
+    uint64_t eg = ( ei ^ (ei>>1) ) << travel_shift;
+    end   = ( ( eg | ( eg >> 3 ) ) & 7 ) ^ start;
+    start = ( ( sg | ( sg >> 3 ) ) & 7 ) ^ start;
+  }
+  return false;
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
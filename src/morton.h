@@ -0,0 +1,38 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MORTON_H
+#define MORTON_H
+#include <stdint.h>
+
+#include "pointset.h"
+
+/** Maximum allowed depth of octree
+ * Note that the sorting procedure has a bound of 21 layers.
+ */
+static const int D = 21;
+
+/** Maximum depth of a pointset, as the hilbert curve only orders 20 layers. */
+static const int MAX_DEPTH = 20;
+
+uint64_t morton3d( uint64_t x, uint64_t y, uint64_t z );
+void morton3d_inverse( uint64_t v, uint32_t & x, uint32_t & y, uint32_t & z );
+uint64_t hilbert3d( const point & p );
+bool hilbert3d_compare( const point & p1,const point & p2 );
+
+#endif
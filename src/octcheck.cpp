@@ -0,0 +1,246 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "octree.h"
+#include "parallel.h"
+#include "timing.h"
+#include "options.h"
+
+/* Checks the integrity of an octree file and reports statistics on its contents.
+ *
+ * The first pass reads all nodes sequentially and checks them individually.
+ * The second pass traverses the octree from the root, one layer at a time,
+ * and checks whether the nodes are linked and averaged correctly.
+ * Both passes divide their work into chunks, which are handled by multiple threads.
+ * Returns a non-zero exit status if any error is found.
+ */
+
+static const uint64_t CHUNK = 1<<16;
+static const uint8_t UNVISITED = 0xff;
+static const int BINS = 8; /// Number of color histogram bins per channel.
+
+/** Counts of the problems and properties found in a range of nodes. */
+struct counts {
+  uint64_t out_of_range; /// Child indices beyond the end of the file.
+  uint64_t dangling; /// Child indices in empty children.
+  uint64_t bad_color; /// Colors that do not fit in 24 bits.
+  uint64_t empty; /// Reachable nodes without children.
+  uint64_t mismatch; /// Colors that differ from the average color of their child node.
+  uint64_t conflict; /// Nodes that are reachable at multiple depths, due to cycles or invalid sharing.
+  uint64_t shared; /// References to a node that was already reached at the same depth, due to repetition.
+  uint64_t nodes;
+  uint64_t leaves;
+  uint64_t filled; /// Non-empty children.
+  uint64_t histogram[3][BINS]; /// Leaf colors per channel.
+  void add(const counts& c) {
+    uint64_t * a = (uint64_t*)this;
+    const uint64_t * b = (const uint64_t*)&c;
+    for (size_t i=0; i<sizeof(counts)/sizeof(uint64_t); i++) a[i] += b[i];
+  }
+};
+
+template<class Node> struct checker {
+  typedef typename Node::index index;
+  const Node * root;
+  uint64_t nodes;
+  std::vector<uint8_t> depth; /// Depth at which each node was reached.
+  std::vector<index> frontier; /// Nodes at the current depth.
+  int current;
+  std::vector<counts> results; /// Counts per chunk.
+  std::vector<std::vector<index> > found; /// Nodes at the next depth per chunk.
+};
+
+/** Checks the nodes in the chunk individually. */
+template<class Node> static void scan_task(uint64_t chunk, void * data) {
+  checker<Node>& c = *(checker<Node>*)data;
+  counts& r = c.results[chunk];
+  uint64_t end = std::min(c.nodes, (chunk+1)*CHUNK);
+  for (uint64_t j=chunk*CHUNK; j<end; j++) {
+    const Node& n = c.root[j];
+    for (int i=0; i<8; i++) {
+      if (n.avgcolor[i]<0) {
+        if (~n.child[i]) r.dangling++;
+        continue;
+      }
+      if (n.avgcolor[i] >= 0x1000000) r.bad_color++;
+      if (~n.child[i] && n.child[i] >= c.nodes) r.out_of_range++;
+    }
+  }
+}
+
+/** Checks the links of the nodes in the chunk of the frontier and collects their children. */
+template<class Node> static void traverse_task(uint64_t chunk, void * data) {
+  checker<Node>& c = *(checker<Node>*)data;
+  counts& r = c.results[chunk];
+  std::vector<typename Node::index>& found = c.found[chunk];
+  uint8_t next = c.current+1;
+  uint64_t end = std::min((uint64_t)c.frontier.size(), (chunk+1)*CHUNK);
+  for (uint64_t j=chunk*CHUNK; j<end; j++) {
+    const Node& n = c.root[c.frontier[j]];
+    r.nodes++;
+    for (int i=0; i<8; i++) {
+      int32_t color = n.avgcolor[i];
+      if (color<0) continue;
+      r.filled++;
+      if (!~n.child[i]) {
+        r.leaves++;
+        if (color < 0x1000000) {
+          r.histogram[0][(color>>16&0xff)*BINS>>8]++;
+          r.histogram[1][(color>>8&0xff)*BINS>>8]++;
+          r.histogram[2][(color&0xff)*BINS>>8]++;
+        }
+        continue;
+      }
+      typename Node::index child = n.child[i];
+      if (child >= c.nodes) continue;
+      const Node& m = c.root[child];
+      bool empty = true;
+      for (int k=0; k<8; k++) {
+        if (m.avgcolor[k]>=0) empty = false;
+      }
+      if (empty) {
+        r.empty++;
+      } else if ((uint32_t)color != average(m)) {
+        r.mismatch++;
+      }
+      uint8_t old = c.depth[child];
+      if (old == UNVISITED && __sync_bool_compare_and_swap(&c.depth[child], UNVISITED, next)) {
+        found.push_back(child);
+      } else if (c.depth[child] == next) {
+        r.shared++;
+      } else {
+        r.conflict++;
+      }
+    }
+  }
+}
+
+static void print_histogram(Timer& t, const counts& r) {
+  static const char * channel[3] = {"Red  ", "Green", "Blue "};
+  printf("[%10.0f] Leaf color histogram (%d bins per channel):\n", t.elapsed(), BINS);
+  for (int i=0; i<3; i++) {
+    printf("[%10.0f]   %s", t.elapsed(), channel[i]);
+    for (int j=0; j<BINS; j++) {
+      printf(" %5.1f%%", r.leaves ? r.histogram[i][j]*100.0/r.leaves : 0.0);
+    }
+    printf("\n");
+  }
+}
+
+/** Runs both passes and returns the number of errors found. */
+template<class Node> static uint64_t check(Timer& t, const Node * root, uint64_t nodes, int threads) {
+  checker<Node> c;
+  c.root = root;
+  c.nodes = nodes;
+
+  // Check the nodes individually.
+  printf("[%10.0f] Checking %lu nodes using %d threads.\n", t.elapsed(), nodes, threads);
+  madvise((void*)root, nodes*sizeof(Node), MADV_SEQUENTIAL);
+  c.results.assign((nodes+CHUNK-1)/CHUNK, counts());
+  parallel_for(threads, c.results.size(), scan_task<Node>, &c);
+  counts scan = counts();
+  for (uint64_t i=0; i<c.results.size(); i++) scan.add(c.results[i]);
+  printf("[%10.0f] Found %lu child indices out of range, %lu dangling child indices and %lu invalid colors.\n",
+         t.elapsed(), scan.out_of_range, scan.dangling, scan.bad_color);
+
+  // Traverse the octree layer by layer.
+  printf("[%10.0f] Traversing octree.\n", t.elapsed());
+  madvise((void*)root, nodes*sizeof(Node), MADV_NORMAL);
+  c.depth.assign(nodes, UNVISITED);
+  counts total = counts();
+  if (nodes) {
+    c.depth[0] = 0;
+    c.frontier.push_back(0);
+  }
+  for (c.current = 0; !c.frontier.empty(); c.current++) {
+    if (c.current+1 >= UNVISITED) {
+      printf("[%10.0f] Octree is too deep, stopped traversal.\n", t.elapsed());
+      total.conflict++;
+      break;
+    }
+    uint64_t chunks = (c.frontier.size()+CHUNK-1)/CHUNK;
+    c.results.assign(chunks, counts());
+    c.found.assign(chunks, std::vector<typename Node::index>());
+    parallel_for(threads, chunks, traverse_task<Node>, &c);
+    counts layer = counts();
+    c.frontier.clear();
+    for (uint64_t i=0; i<chunks; i++) {
+      layer.add(c.results[i]);
+      c.frontier.insert(c.frontier.end(), c.found[i].begin(), c.found[i].end());
+    }
+    printf("[%10.0f] At depth %2d: %10lu nodes, %10lu leaves, %5.1f%% filled, %lu shared.\n",
+           t.elapsed(), c.current, layer.nodes, layer.leaves, layer.filled*100.0/(layer.nodes*8), layer.shared);
+    total.add(layer);
+  }
+  uint64_t unreachable = nodes - total.nodes;
+  printf("[%10.0f] Reached %lu of %lu nodes (%lu unreachable), with %lu leaves.\n", t.elapsed(), total.nodes, nodes, unreachable, total.leaves);
+  printf("[%10.0f] Found %lu empty nodes, %lu colors that differ from the average of their child and %lu nodes reachable at multiple depths.\n",
+         t.elapsed(), total.empty, total.mismatch, total.conflict);
+  print_histogram(t, total);
+  return scan.out_of_range + scan.dangling + scan.bad_color + total.empty + total.mismatch + total.conflict;
+}
+
+static void usage() {
+  fprintf(stderr,"Please specify the octree file to check.\n");
+  fprintf(stderr,"Usage: octcheck [-j threads] file.oct\n");
+  fprintf(stderr,"  -j threads Number of threads to use (default: all processors).\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  int threads = processor_count();
+  int opt;
+  while ((opt = getopt(argc, argv, "j:")) != -1) {
+    switch (opt) {
+      case 'j':
+        threads = parse_int(optarg, "number of threads");
+        if (threads<=0) threads = processor_count();
+        break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2) usage();
+
+  printf("[%10.0f] Opening '%s'.\n", t.elapsed(), argv[1]);
+  octree_file in(argv[1]);
+  uint64_t errors;
+  if (in.wide) {
+    errors = check(t, in.root64, in.size/sizeof(octree64), threads);
+  } else {
+    errors = check(t, in.root, in.size/sizeof(octree), threads);
+  }
+  if (errors) {
+    printf("[%10.0f] Found %lu errors.\n", t.elapsed(), errors);
+    return 1;
+  }
+  printf("[%10.0f] No errors found.\n", t.elapsed());
+  return 0;
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -18,7 +18,10 @@
 
 #ifndef OCTREE_H
 #define OCTREE_H
+#include <stddef.h>
 #include <stdint.h>
+#include <map>
+#include <vector>
 
 /** A node in an octree. 
  *
@@ -31,24 +34,230 @@
  * etc...
  * 
  */
-struct octree {
-    uint32_t child[8];
+template<class Index> struct octree_node {
+    typedef Index index;
+    Index child[8];
     int32_t avgcolor[8];
 };
+typedef octree_node<uint32_t> octree;
+/** A node with 64-bit child indices, used for octrees with 2^32 or more nodes. */
+typedef octree_node<uint64_t> octree64;
 
+/**
+ * Maps an octree file to memory.
+ * Files with a name ending in '.oct64' contain nodes with 64-bit indices, 
+ * which are available through root64 instead of root.
+ */
 struct octree_file {
     const bool write;
-    uint32_t size;
+    const bool wide;
+    uint64_t size;
     int32_t fd;
     octree * root;
+    octree64 * root64;
     octree_file(const char * filename);
-    octree_file(const char * filename, uint32_t size);
+    octree_file(const char * filename, uint64_t size);
     ~octree_file();
+    /** Returns the number of nodes in the file. */
+    uint64_t nodes() const {return size / (wide ? sizeof(octree64) : sizeof(octree));}
+    /** Returns the node at the given index with 64-bit indices, regardless of those of the file. */
+    octree64 node(uint64_t index) const;
 private:
+    void map(int prot, int flags);
     octree_file(octree_file &);
     octree_file& operator=(octree_file&);
 };
 
-void octree_draw(octree_file* file);
+/**
+ * Opens an octree file for writing out nodes sequentially.
+ * Index 0 is reserved for the root, which is usually finished last 
+ * and hence must be written separately using set_root.
+ * When appending, the nodes are added after those already in the file.
+ */
+template<class Node> struct node_stream {
+    typedef Node node;
+    int32_t fd;
+    Node * buffer;
+    int cnt;
+    typename Node::index nodes; /// Number of nodes in the file, including the root.
+    node_stream(const char * filename, bool append=false);
+    ~node_stream();
+    typename Node::index add(const Node &n);
+    void set_root(const Node &n);
+    void flush();
+private:
+    node_stream(node_stream &);
+    node_stream& operator=(node_stream&);
+};
+typedef node_stream<octree> octree_stream;
+/** Writes a '.oct64' file, of which the nodes have 64-bit indices. */
+typedef node_stream<octree64> octree64_stream;
+
+/**
+ * Writes nodes sequentially, like octree_stream, to a file with 32-bit or 64-bit indices depending on its name.
+ * The nodes are given with 64-bit indices, which must fit in the indices of the file.
+ * Without a file name, the nodes are only counted, such that the size of the indices can be determined beforehand.
+ */
+struct octree_writer {
+    uint64_t nodes; /// Number of nodes, including the root.
+    octree_writer();
+    octree_writer(const char * filename, bool append=false);
+    ~octree_writer();
+    uint64_t add(const octree64 &n);
+    void set_root(const octree64 &n);
+    void flush();
+private:
+    octree_stream * narrow;
+    octree64_stream * wide;
+    octree_writer(octree_writer &);
+    octree_writer& operator=(octree_writer&);
+};
+
+/**
+ * Applies insertions and deletions of voxels to an existing octree file.
+ * 
+ * Voxel coordinates are given at the resolution of the leaves, which are stored in the lowest layer of nodes.
+ * Modified nodes are kept in memory until commit is called. New nodes are taken from the free list,
+ * or appended to the end of the file. Nodes that become empty are added to the free list,
+ * which is stored in 'filename.free'. Only the average colors along the modified paths are updated.
+ * 
+ * A commit first writes the modified nodes to the journal 'filename.journal' and then applies them.
+ * If this is interrupted, the commit is completed when the file is opened again.
+ * Uncommitted changes are discarded.
+ */
+struct octree_edit {
+    char * filename;
+    int32_t fd;
+    uint64_t size;
+    octree * root;
+    int depth; /// Number of layers of nodes.
+    uint32_t nodes; /// Number of nodes in the file, including those appended since the last commit.
+    octree_edit(const char * filename);
+    ~octree_edit();
+    bool insert(uint32_t x, uint32_t y, uint32_t z, uint32_t color);
+    bool erase(uint32_t x, uint32_t y, uint32_t z);
+    uint32_t modified() const {return dirty.size();}
+    void commit();
+private:
+    std::map<uint32_t, octree> dirty;
+    std::vector<uint32_t> free_list;
+    void map();
+    void unmap();
+    const octree& get(uint32_t index) const;
+    octree& edit(uint32_t index);
+    uint32_t allocate();
+    void update(const uint32_t * path, uint32_t x, uint32_t y, uint32_t z);
+    octree_edit(octree_edit &);
+    octree_edit& operator=(octree_edit&);
+};
+
+/** Accumulates colors, used to average the points that fall into the same voxel. */
+struct color_sum {
+    uint64_t r, g, b, n;
+    color_sum() : r(0), g(0), b(0), n(0) {}
+    void add(uint32_t c) {
+        r += (c&0xff0000)>>16;
+        g += (c&0xff00)>>8;
+        b += (c&0xff);
+        n++;
+    }
+    uint32_t average() const;
+};
+
+/** Collects nodes in memory, such as the nodes of a subtree that is built by a worker thread. */
+struct octree_arena {
+    typedef octree node;
+    std::vector<octree> nodes;
+    uint32_t add(const octree& n) {
+        nodes.push_back(n);
+        return nodes.size()-1;
+    }
+};
+
+/**
+ * Builds an octree in a single pass over points that are added along a space filling curve,
+ * such that the points within each node are added consecutively, like in Morton or Hilbert order.
+ * 
+ * Only the node that is currently being filled is kept in memory for each layer.
+ * Finished nodes are added to the output, which is an octree_stream, octree64_stream or an octree_arena,
+ * hence they are stored in post-order. The top node is returned by close, instead of being added.
+ * Points in the same leaf are averaged. The given number of bottom layers is pruned.
+ */
+template<class Out> struct node_builder {
+    typedef typename Out::node node;
+    Out& out;
+    uint64_t points;
+    node_builder(Out& out, int bottom_layer=0);
+    /** Adds a point, given by its Morton key morton3d(z, y, x). */
+    void add(uint64_t key, uint32_t color);
+    /** Returns the number of data layers of the points added so far, which is more than the number of pruned layers. */
+    int layers() const;
+    /** Closes the nodes below the given layer and returns the node at that layer, which must contain all points. */
+    node close(int layer);
+private:
+    int bottom_layer;
+    std::vector<node> open; /// Node that is being filled per layer.
+    color_sum leaf;
+    uint64_t old; /// Key of the previous point.
+    uint64_t bits;
+    void store_leaf();
+    void close_node(uint64_t key, int depth);
+};
+
+/**
+ * Builds an octree file in a single pass, see node_builder. 
+ * The root is stored at index 0, before the other nodes.
+ */
+struct octree_builder {
+    octree_stream out;
+    uint64_t points;
+    octree_builder(const char * filename, int bottom_layer=0) : out(filename), points(0), tree(out, bottom_layer) {}
+    /** Adds a point, given by its Morton key morton3d(z, y, x). */
+    void add(uint64_t key, uint32_t color) {
+        tree.add(key, color);
+        points++;
+    }
+    /** Closes the remaining nodes and writes the root. Returns the number of data layers. */
+    int finish() {
+        int layers = tree.layers();
+        out.set_root(tree.close(layers));
+        return layers;
+    }
+private:
+    node_builder<octree_stream> tree;
+};
+
+uint32_t rgb(int32_t r, int32_t g, int32_t b);
+uint32_t rgb(float r, float g, float b);
+template<class Index> uint32_t average(const octree_node<Index>& node);
+template<class Index> void clear(octree_node<Index>& n);
+template<class Index> int octree_depth(const octree_node<Index> * root, uint64_t nodes);
+/** 
+ * Records the number of lowest layers that were pruned when building the given octree file in 'filename.meta',
+ * such that the leaves can be matched to the coordinates of the pointset.
+ */
+void write_pruned_layers(const char * filename, int layers);
+/** Returns the number of pruned layers recorded for the given octree file, or -1 if none are recorded. */
+int read_pruned_layers(const char * filename);
+/** Converts a node to one with a different index size. Its child indices must fit. */
+template<class To, class From> To convert_node(const From& n) {
+    To m;
+    for (int i=0; i<8; i++) {
+        m.child[i] = ~n.child[i] ? n.child[i] : ~(typename To::index)0;
+        m.avgcolor[i] = n.avgcolor[i];
+    }
+    return m;
+}
+
+/** Timings and traversal counters of a rendered frame. */
+struct draw_stats {
+    double prepare, query, transfer; /// Time in milliseconds.
+    uint64_t count; /// Number of calls to traverse.
+    uint64_t count_oct; /// Number of octree nodes that passed the frustum test.
+    uint64_t count_quad; /// Number of quadtree nodes that were descended into.
+};
+
+/** Renders the octree. The statistics of the frame are stored in stats if given, and printed otherwise. */
+void octree_draw(octree_file* file, draw_stats * stats=NULL);
 
 #endif
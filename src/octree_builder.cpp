@@ -0,0 +1,77 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+
+#include "octree.h"
+#include "morton.h"
+
+template<class Out> node_builder<Out>::node_builder(Out& out, int bottom_layer) : out(out), points(0), bottom_layer(bottom_layer), open(D+1), old(0), bits(0) {
+    assert(bottom_layer>=0 && bottom_layer<D);
+    for (int j=0; j<=D; j++) clear(open[j]);
+}
+
+/** Stores the average color of the points in the previous leaf and resets the sum. */
+template<class Out> void node_builder<Out>::store_leaf() {
+    open[bottom_layer+1].avgcolor[(old >> bottom_layer*3)&7] = leaf.average();
+    leaf = color_sum();
+}
+
+/** Adds the finished node at the given depth to the output and links it into its parent. */
+template<class Out> void node_builder<Out>::close_node(uint64_t key, int depth) {
+    int idx = (key >> depth*3)&7;
+    open[depth+1].avgcolor[idx] = average(open[depth]);
+    open[depth+1].child[idx] = out.add(open[depth]);
+    clear(open[depth]);
+}
+
+template<class Out> void node_builder<Out>::add(uint64_t key, uint32_t color) {
+    assert(color<0x1000000);
+    if (points == 0) old = key;
+    if ((key ^ old) >> bottom_layer*3) store_leaf();
+    for (int j = bottom_layer+1; j < D && (key>>j*3) != (old>>j*3); j++) {
+        close_node(old, j);
+    }
+    leaf.add(color);
+    bits |= key;
+    old = key;
+    points++;
+}
+
+template<class Out> int node_builder<Out>::layers() const {
+    int layers=0;
+    while(bits>>layers*3) layers++;
+    return layers<=bottom_layer ? bottom_layer+1 : layers;
+}
+
+template<class Out> typename node_builder<Out>::node node_builder<Out>::close(int layer) {
+    assert(layer>bottom_layer && layer<=D);
+    if (leaf.n) store_leaf();
+    for (int depth = bottom_layer+1; depth < layer; depth++) {
+        close_node(old, depth);
+    }
+    node top = open[layer];
+    clear(open[layer]);
+    return top;
+}
+
+template struct node_builder<octree_stream>;
+template struct node_builder<octree64_stream>;
+template struct node_builder<octree_arena>;
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
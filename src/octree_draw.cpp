@@ -33,7 +33,7 @@ using std::min;
 
 namespace {
     quadtree face;
-    octree * root;
+    const void * root; /// Either octree or octree64 nodes.
     int C;
     int count, count_oct, count_quad;
 }
@@ -65,9 +65,10 @@ const v4si nil = {};
  * The bounds array is ordered as DELTA.
  * C is the corner that is furthest away from the camera.
  * Furthermore, pos is the location of the center of the octree node, relative to the viewer in octree space.
+ * The node type determines the width of the octree node indices.
  */
-static bool traverse(
-    const int32_t quadnode, const uint32_t octnode, const uint32_t octcolor, 
+template<class Node> static bool traverse(
+    const int32_t quadnode, const typename Node::index octnode, const uint32_t octcolor, 
     const v4si bound, const v4si dx, const v4si dy, const v4si dz, const v4si dltz, const v4si dgtz,
     const v4si pos, const int depth
 ){    
@@ -78,7 +79,7 @@ static bool traverse(
     // Recursion
     if (depth>=0 && bound[1] - bound[0] <= 4<<SCENE_DEPTH) {
         // Traverse octree
-        octree &s = root[octnode];
+        const Node &s = ((const Node*)root)[octnode];
         v4si octant = -(pos<0);
         int furthest = (octant[0]<<2)|(octant[1]<<1)|(octant[2]<<0);
         for (int k = 0; k<8; k++) {
@@ -93,9 +94,9 @@ static bool traverse(
             if ((ltz[0] & gtz[1] & ltz[2] & gtz[3]) == 0) continue; // frustum occlusion
             count_oct++;
             if (~octnode) {
-                if (traverse(quadnode, s.child[i], s.avgcolor[i], new_bound, dx, dy, dz, dltz, dgtz, pos + (DELTA[i]<<depth), depth-1)) return true;
+                if (traverse<Node>(quadnode, s.child[i], s.avgcolor[i], new_bound, dx, dy, dz, dltz, dgtz, pos + (DELTA[i]<<depth), depth-1)) return true;
             } else {
-                if (traverse(quadnode, ~0u, octcolor, new_bound, dx, dy, dz, dltz, dgtz, pos + (DELTA[i]<<depth), depth-1)) return true;
+                if (traverse<Node>(quadnode, ~(typename Node::index)0, octcolor, new_bound, dx, dy, dz, dltz, dgtz, pos + (DELTA[i]<<depth), depth-1)) return true;
             }
         }
         return false;
@@ -125,7 +126,7 @@ static bool traverse(
             gtz = (new_bound - new_dgtz)>0;
             if ((ltz[0] & gtz[1] & ltz[2] & gtz[3]) == 0) continue; // frustum occlusion
             if (quadnode<(int)quadtree::L) {
-                traverse(quadnode*16+i+1, octnode, octcolor, new_bound, new_dx, new_dy, new_dz, new_dltz, new_dgtz, pos, depth); 
+                traverse<Node>(quadnode*16+i+1, octnode, octcolor, new_bound, new_dx, new_dy, new_dz, new_dltz, new_dgtz, pos, depth); 
                 count_quad++;
             } else {
                 face.set_face(quadnode, i, octcolor); // Rendering
@@ -145,14 +146,14 @@ static const double quadtree_bounds[] = {
 
 /** Render the octree to the OpenGL cubemap texture. 
  */
-void octree_draw(octree_file * file) {
+void octree_draw(octree_file * file, draw_stats * stats) {
     Timer t_global;
     
     double timer_prepare;
     double timer_query;
     double timer_transfer;
     
-    root = file->root;
+    root = file->wide ? (const void*)file->root64 : (const void*)file->root;
     
     Timer t_prepare;
         
@@ -188,7 +189,11 @@ void octree_draw(octree_file * file) {
     v4si new_dz = (bounds[C^DZ]-bounds[C]);
     v4si new_dltz = (new_dx<0)*new_dx + (new_dy<0)*new_dy + (new_dz<0)*new_dz;
     v4si new_dgtz = (new_dx>0)*new_dx + (new_dy>0)*new_dy + (new_dz>0)*new_dz;
-    traverse(0, 0, 0, bounds[C], new_dx, new_dy, new_dz, new_dltz, new_dgtz, -pos, SCENE_DEPTH-1);
+    if (file->wide) {
+        traverse<octree64>(0, 0, 0, bounds[C], new_dx, new_dy, new_dz, new_dltz, new_dgtz, -pos, SCENE_DEPTH-1);
+    } else {
+        traverse<octree>(0, 0, 0, bounds[C], new_dx, new_dy, new_dz, new_dltz, new_dgtz, -pos, SCENE_DEPTH-1);
+    }
     
     
     timer_query = t_query.elapsed();
@@ -200,6 +205,15 @@ void octree_draw(octree_file * file) {
     
     timer_transfer = t_transfer.elapsed();
             
+    if (stats) {
+        stats->prepare = timer_prepare;
+        stats->query = timer_query;
+        stats->transfer = timer_transfer;
+        stats->count = count;
+        stats->count_oct = count_oct;
+        stats->count_quad = count_quad;
+        return;
+    }
     std::printf("%7.2f | Prepare:%4.2f Query:%7.2f Transfer:%5.2f | Count:%10d Oct:%10d Quad:%10d\n", t_global.elapsed(), timer_prepare, timer_query, timer_transfer, count, count_oct, count_quad);
 }
 
@@ -0,0 +1,293 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "octree.h"
+
+static const uint32_t JOURNAL_MAGIC = 0x4c4e524a; // "JRNL"
+
+struct journal_header {
+    uint32_t magic;
+    uint32_t nodes; /// Number of nodes in the file after the commit.
+    uint32_t records;
+    uint32_t free; /// Length of the free list after the commit.
+};
+
+struct journal_record {
+    uint32_t index;
+    octree node;
+};
+
+static void write_all(int fd, const void * data, size_t bytes, const char * what) {
+    if (write(fd, data, bytes) != (ssize_t)bytes) {perror(what); exit(1);}
+}
+
+static void read_all(int fd, void * data, size_t bytes, const char * what) {
+    if (read(fd, data, bytes) != (ssize_t)bytes) {perror(what); exit(1);}
+}
+
+/** Flushes the directory containing the given file, such that renaming or removing the file is persisted. */
+static void sync_dir(const char * filename) {
+    char dir[strlen(filename)+1];
+    strcpy(dir, filename);
+    int fd = open(dirname(dir), O_RDONLY);
+    if (fd == -1) {perror("Could not open directory"); exit(1);}
+    if (fsync(fd)) {perror("Could not synchronize directory"); exit(1);}
+    close(fd);
+}
+
+/**
+ * Applies the journal of the given octree file, if it exists, and removes it afterwards.
+ * Applying a journal again has no further effect, hence this can be repeated after a crash.
+ * A journal that was not completely written is discarded, as its commit did not take place.
+ */
+static void replay(const char * filename) {
+    int length = strlen(filename);
+    char journal[length+9];
+    char temp[length+13];
+    char freefile[length+6];
+    sprintf(journal, "%s.journal", filename);
+    sprintf(temp, "%s.journal.tmp", filename);
+    sprintf(freefile, "%s.free", filename);
+    unlink(temp);
+
+    int jfd = open(journal, O_RDONLY);
+    if (jfd == -1) {
+        if (errno == ENOENT) return;
+        perror("Could not open journal"); exit(1);
+    }
+    journal_header h;
+    read_all(jfd, &h, sizeof(h), "Could not read journal");
+    if (h.magic != JOURNAL_MAGIC) {
+        fprintf(stderr, "Invalid journal '%s'.\n", journal);
+        exit(1);
+    }
+    std::vector<journal_record> records(h.records);
+    std::vector<uint32_t> free_list(h.free);
+    read_all(jfd, records.data(), records.size()*sizeof(journal_record), "Could not read journal");
+    read_all(jfd, free_list.data(), free_list.size()*sizeof(uint32_t), "Could not read journal");
+    close(jfd);
+
+    int fd = open(filename, O_WRONLY);
+    if (fd == -1) {perror("Could not open file"); exit(1);}
+    if (ftruncate(fd, (off_t)h.nodes*sizeof(octree))) {perror("Could not resize file"); exit(1);}
+    for (uint32_t i=0; i<h.records; i++) {
+        ssize_t ret = pwrite(fd, &records[i].node, sizeof(octree), (off_t)records[i].index*sizeof(octree));
+        if (ret != sizeof(octree)) {perror("Could not write node"); exit(1);}
+    }
+    if (fsync(fd)) {perror("Could not synchronize file"); exit(1);}
+    close(fd);
+
+    int ffd = open(freefile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ffd == -1) {perror("Could not open/create free list"); exit(1);}
+    write_all(ffd, free_list.data(), free_list.size()*sizeof(uint32_t), "Could not write free list");
+    if (fsync(ffd)) {perror("Could not synchronize free list"); exit(1);}
+    close(ffd);
+
+    if (unlink(journal)) {perror("Could not remove journal"); exit(1);}
+    sync_dir(filename);
+}
+
+/** Returns the index of the child containing the given voxel, for a node at the given layer above the leaves. */
+static inline int slot(uint32_t x, uint32_t y, uint32_t z, int layer) {
+    return ((x>>layer)&1)<<2 | ((y>>layer)&1)<<1 | ((z>>layer)&1);
+}
+
+/**
+ * Opens an octree file for editing, completing an interrupted commit if necessary.
+ */
+octree_edit::octree_edit(const char * filename) : filename(strdup(filename)) {
+    replay(filename);
+    map();
+
+    char freefile[strlen(filename)+6];
+    sprintf(freefile, "%s.free", filename);
+    int ffd = open(freefile, O_RDONLY);
+    if (ffd != -1) {
+        free_list.resize(lseek(ffd, 0, SEEK_END)/sizeof(uint32_t));
+        if (pread(ffd, free_list.data(), free_list.size()*sizeof(uint32_t), 0) != (ssize_t)(free_list.size()*sizeof(uint32_t))) {
+            perror("Could not read free list"); exit(1);
+        }
+        close(ffd);
+    }
+
+    depth = octree_depth(root, nodes);
+    if (depth == 0) {
+        fprintf(stderr, "Cannot determine the depth of '%s', as it is empty or invalid.\n", filename);
+        exit(1);
+    }
+}
+
+octree_edit::~octree_edit() {
+    unmap();
+    free(filename);
+}
+
+void octree_edit::map() {
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {perror("Could not open file"); exit(1);}
+    size = lseek(fd, 0, SEEK_END);
+    assert(size % sizeof(octree) == 0);
+    root = (octree*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (root == MAP_FAILED) {perror("Could not map file to memory"); exit(1);}
+    nodes = size / sizeof(octree);
+}
+
+void octree_edit::unmap() {
+    munmap(root, size);
+    close(fd);
+}
+
+/** Returns the current state of the node, including uncommitted changes. */
+const octree& octree_edit::get(uint32_t index) const {
+    std::map<uint32_t, octree>::const_iterator it = dirty.find(index);
+    if (it != dirty.end()) return it->second;
+    assert(index < size/sizeof(octree));
+    return root[index];
+}
+
+/** Returns the node for modification, copying it into memory if necessary. */
+octree& octree_edit::edit(uint32_t index) {
+    std::map<uint32_t, octree>::iterator it = dirty.find(index);
+    if (it != dirty.end()) return it->second;
+    assert(index < size/sizeof(octree));
+    octree& n = dirty[index];
+    n = root[index];
+    return n;
+}
+
+/** Returns the index of a new empty node, which is reused from the free list if possible. */
+uint32_t octree_edit::allocate() {
+    uint32_t index;
+    if (free_list.empty()) {
+        assert(~nodes);
+        index = nodes++;
+    } else {
+        index = free_list.back();
+        free_list.pop_back();
+    }
+    clear(dirty[index]);
+    return index;
+}
+
+/**
+ * Updates the average colors along the given path from the bottom up.
+ * Nodes that became empty are removed from their parent and added to the free list.
+ * Due to repetition, a node can be referenced by multiple children of its parent.
+ */
+void octree_edit::update(const uint32_t * path, uint32_t x, uint32_t y, uint32_t z) {
+    for (int l=0; l<depth-1; l++) {
+        const octree& n = get(path[l]);
+        bool empty = true;
+        for (int i=0; i<8; i++) {
+            if (n.avgcolor[i]>=0) empty = false;
+        }
+        int32_t color = empty ? -1 : average(n);
+        octree& parent = edit(path[l+1]);
+        assert(parent.child[slot(x, y, z, l+1)] == path[l]);
+        for (int i=0; i<8; i++) {
+            if (parent.child[i] != path[l]) continue;
+            parent.avgcolor[i] = color;
+            if (empty) parent.child[i] = ~0u;
+        }
+        if (empty) free_list.push_back(path[l]);
+    }
+}
+
+/** Sets the color of the given voxel, creating it if necessary. Returns false if it lies outside of the octree. */
+bool octree_edit::insert(uint32_t x, uint32_t y, uint32_t z, uint32_t color) {
+    if ((x|y|z)>>depth) return false;
+    assert(color<0x1000000);
+    uint32_t path[32];
+    path[depth-1] = 0;
+    for (int l=depth-1; l>0; l--) {
+        int i = slot(x, y, z, l);
+        uint32_t c = get(path[l]).child[i];
+        if (!~c) {
+            c = allocate();
+            edit(path[l]).child[i] = c;
+        }
+        path[l-1] = c;
+    }
+    edit(path[0]).avgcolor[slot(x, y, z, 0)] = color;
+    update(path, x, y, z);
+    return true;
+}
+
+/** Removes the given voxel. Returns false if it did not exist. */
+bool octree_edit::erase(uint32_t x, uint32_t y, uint32_t z) {
+    if ((x|y|z)>>depth) return false;
+    uint32_t path[32];
+    path[depth-1] = 0;
+    for (int l=depth-1; l>0; l--) {
+        uint32_t c = get(path[l]).child[slot(x, y, z, l)];
+        if (!~c) return false;
+        path[l-1] = c;
+    }
+    int i = slot(x, y, z, 0);
+    if (get(path[0]).avgcolor[i]<0) return false;
+    edit(path[0]).avgcolor[i] = -1;
+    update(path, x, y, z);
+    return true;
+}
+
+/**
+ * Writes the modified nodes to disk.
+ * The changes are first written to a temporary journal, which is renamed once it is complete.
+ * From then on the commit is durable and the journal is applied to the octree file.
+ */
+void octree_edit::commit() {
+    if (dirty.empty()) return;
+    int length = strlen(filename);
+    char journal[length+9];
+    char temp[length+13];
+    sprintf(journal, "%s.journal", filename);
+    sprintf(temp, "%s.journal.tmp", filename);
+
+    int jfd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (jfd == -1) {perror("Could not open/create journal"); exit(1);}
+    journal_header h = {JOURNAL_MAGIC, nodes, (uint32_t)dirty.size(), (uint32_t)free_list.size()};
+    std::vector<journal_record> records;
+    records.reserve(dirty.size());
+    for (std::map<uint32_t, octree>::iterator it = dirty.begin(); it != dirty.end(); ++it) {
+        journal_record r = {it->first, it->second};
+        records.push_back(r);
+    }
+    write_all(jfd, &h, sizeof(h), "Could not write journal");
+    write_all(jfd, records.data(), records.size()*sizeof(journal_record), "Could not write journal");
+    write_all(jfd, free_list.data(), free_list.size()*sizeof(uint32_t), "Could not write journal");
+    if (fsync(jfd)) {perror("Could not synchronize journal"); exit(1);}
+    close(jfd);
+    if (rename(temp, journal)) {perror("Could not commit journal"); exit(1);}
+    sync_dir(filename);
+
+    unmap();
+    replay(filename);
+    dirty.clear();
+    map();
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
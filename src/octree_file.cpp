@@ -18,6 +18,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <fcntl.h>
 #include <unistd.h>
@@ -26,18 +27,30 @@
 
 char * octree_available = NULL;
 
+/** Returns whether the file name indicates nodes with 64-bit indices. */
+static bool is_wide(const char * filename) {
+    size_t length = strlen(filename);
+    return length >= 6 && !strcmp(filename + length - 6, ".oct64");
+}
+
+void octree_file::map(int prot, int flags) {
+    assert(size % (wide ? sizeof(octree64) : sizeof(octree)) == 0);
+    void * data = mmap(NULL, size, prot, flags, fd, 0);
+    if (data == MAP_FAILED) {perror("Could not map file to memory"); exit(1);} 
+    root = wide ? NULL : (octree*)data;
+    root64 = wide ? (octree64*)data : NULL;
+}
+
 /** 
  * Maps the given octree file to memory for reading and rendering.
  * 
  * It is unclear whether using MAP_PRIVATE or MAP_SHARED for mmap makes any difference.
  */
-octree_file::octree_file(const char* filename) : write(false) {
+octree_file::octree_file(const char* filename) : write(false), wide(is_wide(filename)) {
     fd = open(filename, O_RDONLY);
     if (fd == -1) {perror("Could not open file"); exit(1);}
     size = lseek(fd, 0, SEEK_END);
-    assert(size % sizeof(octree) == 0);
-    root = (octree*)mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
-    if (root == MAP_FAILED) {perror("Could not map file to memory"); exit(1);} 
+    map(PROT_READ, MAP_PRIVATE | MAP_NORESERVE);
 }
 
 /** 
@@ -45,21 +58,191 @@ octree_file::octree_file(const char* filename) : write(false) {
  * 
  * This requires MAP_SHARED for mmap as changes must be written to disk
  */
-octree_file::octree_file(const char* filename, uint32_t size) : write(true), size(size) {
+octree_file::octree_file(const char* filename, uint64_t size) : write(true), wide(is_wide(filename)), size(size) {
     fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
     if (fd == -1) {perror("Could not open/creat file"); exit(1);}
     int ret = ftruncate(fd, size);
     if (ret) {perror("Could not reserve diskspace"); exit(1);}
-    assert(size % sizeof(octree) == 0);
-    root = (octree*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (root == MAP_FAILED) {perror("Could not map file to memory"); exit(1);} 
+    map(PROT_READ | PROT_WRITE, MAP_SHARED);
 }
 
 octree_file::~octree_file() {
-    if (root!=MAP_FAILED)
-        munmap(root, size);
+    munmap(wide ? (void*)root64 : (void*)root, size);
+    if (fd!=-1)
+        close(fd);
+}
+
+octree64 octree_file::node(uint64_t index) const {
+    return wide ? root64[index] : convert_node<octree64>(root[index]);
+}
+
+#define CLAMP(x,l,u) (x<l?l:x>u?u:x)
+uint32_t rgb(int32_t r, int32_t g, int32_t b) {
+    return CLAMP(r,0,255)<<16|CLAMP(g,0,255)<<8|CLAMP(b,0,255);
+}
+uint32_t rgb(float r, float g, float b) {
+    return rgb((int32_t)(r+0.5),(int32_t)(g+0.5),(int32_t)(b+0.5));
+}
+
+uint32_t color_sum::average() const {
+    return rgb((float)((double)r/n), (float)((double)g/n), (float)((double)b/n));
+}
+
+/** Computes the average color of a node from the colors of its children. */
+template<class Index> uint32_t average(const octree_node<Index>& node) {
+    float r=0, g=0, b=0;
+    int n=0;
+    for (int i=0; i<8; i++) {
+        if(node.avgcolor[i]>=0) {
+            int v = node.avgcolor[i];
+            r += (v&0xff0000)>>16;
+            g += (v&0xff00)>>8;
+            b += (v&0xff);
+            n++;
+        }
+    }
+    return rgb(r/n,g/n,b/n);
+}
+template uint32_t average(const octree& node);
+template uint32_t average(const octree64& node);
+
+/** Makes the node empty. */
+template<class Index> void clear(octree_node<Index>& n) {
+    for (int i=0; i<8; i++) {
+        n.avgcolor[i]=-1;
+        n.child[i]=~(Index)0;
+    }
+}
+template void clear(octree& n);
+template void clear(octree64& n);
+
+/**
+ * Determines the number of layers of nodes by descending to the first leaf.
+ * Returns 0 if the octree is empty or invalid.
+ */
+template<class Index> int octree_depth(const octree_node<Index> * root, uint64_t nodes) {
+    int depth = 0;
+    Index index = 0;
+    while (~index) {
+        if (index >= nodes || depth >= 31) return 0;
+        const octree_node<Index>& n = root[index];
+        depth++;
+        int i=0;
+        while (i<8 && n.avgcolor[i]<0) i++;
+        if (i==8) return 0;
+        index = n.child[i];
+    }
+    return depth;
+}
+template int octree_depth(const octree * root, uint64_t nodes);
+template int octree_depth(const octree64 * root, uint64_t nodes);
+
+void write_pruned_layers(const char * filename, int layers) {
+    char meta[strlen(filename)+6];
+    sprintf(meta, "%s.meta", filename);
+    FILE * f = fopen(meta, "w");
+    if (!f) {perror("Could not create metadata file"); exit(1);}
+    fprintf(f, "pruned %d\n", layers);
+    if (fclose(f)) {perror("Could not write metadata file"); exit(1);}
+}
+
+int read_pruned_layers(const char * filename) {
+    char meta[strlen(filename)+6];
+    sprintf(meta, "%s.meta", filename);
+    FILE * f = fopen(meta, "r");
+    if (!f) return -1;
+    int layers = -1;
+    char line[256];
+    int n;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "pruned %d", &n) == 1 && n >= 0) layers = n;
+    }
+    fclose(f);
+    return layers;
+}
+
+static const int node_buffer_size = 1<<14;
+template<class Node> node_stream<Node>::node_stream(const char* filename, bool append) {
+    fd = open(filename, append ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {perror("Could not open/create file"); exit(1);}
+    nodes = 1;
+    if (append) {
+        off_t size = lseek(fd, 0, SEEK_END);
+        if (size == -1) {perror("Could not seek to end of file"); exit(1);}
+        if (size == 0 || size % sizeof(Node)) {fprintf(stderr, "Cannot append to '%s', which is not an octree file.\n", filename); exit(1);}
+        if ((uint64_t)size / sizeof(Node) > (typename Node::index)~0) {fprintf(stderr, "Too many nodes for %lu-bit indices.\n", sizeof(nodes)*8); exit(1);}
+        nodes = size / sizeof(Node);
+    } else {
+        if (lseek(fd, sizeof(Node), SEEK_SET) == -1) {perror("Could not reserve root node"); exit(1);}
+    }
+    buffer = new Node[node_buffer_size];
+    cnt = 0;
+}
+
+template<class Node> node_stream<Node>::~node_stream() {
+    flush();
+    delete[] buffer;
     if (fd!=-1)
         close(fd);
 }
 
-// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle; 
+/** Appends a node to the file and returns its index. */
+template<class Node> typename Node::index node_stream<Node>::add(const Node& n) {
+    if (!~nodes) {fprintf(stderr, "Too many nodes for %lu-bit indices.\n", sizeof(nodes)*8); exit(1);}
+    buffer[cnt] = n;
+    cnt++;
+    if (cnt >= node_buffer_size) flush();
+    return nodes++;
+}
+
+/** Writes the root node, which is stored at the start of the file. */
+template<class Node> void node_stream<Node>::set_root(const Node& n) {
+    ssize_t ret = pwrite(fd, &n, sizeof(Node), 0);
+    if (ret != sizeof(Node)) {perror("Could not write root node"); exit(1);}
+}
+
+template<class Node> void node_stream<Node>::flush() {
+    ssize_t bytes = cnt * sizeof(Node);
+    if (write(fd, buffer, bytes) != bytes) {perror("Could not write to file"); exit(1);}
+    cnt = 0;
+}
+
+template struct node_stream<octree>;
+template struct node_stream<octree64>;
+
+octree_writer::octree_writer() : nodes(1), narrow(NULL), wide(NULL) {}
+
+octree_writer::octree_writer(const char* filename, bool append) : nodes(1), narrow(NULL), wide(NULL) {
+    if (is_wide(filename)) {
+        wide = new octree64_stream(filename, append);
+        nodes = wide->nodes;
+    } else {
+        narrow = new octree_stream(filename, append);
+        nodes = narrow->nodes;
+    }
+}
+
+octree_writer::~octree_writer() {
+    delete narrow;
+    delete wide;
+}
+
+/** Appends a node to the file, or only counts it, and returns its index. */
+uint64_t octree_writer::add(const octree64& n) {
+    if (narrow) narrow->add(convert_node<octree>(n));
+    if (wide) wide->add(n);
+    return nodes++;
+}
+
+void octree_writer::set_root(const octree64& n) {
+    if (narrow) narrow->set_root(convert_node<octree>(n));
+    if (wide) wide->set_root(n);
+}
+
+/** Writes the buffered nodes to the file. */
+void octree_writer::flush() {
+    if (narrow) narrow->flush();
+    if (wide) wide->flush();
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,47 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <errno.h>
+
+#include "options.h"
+
+int parse_int(const char * str, const char * what) {
+  char * endptr = NULL;
+  errno = 0;
+  int value = strtol(str, &endptr, 10);
+  if (errno || endptr==str || endptr[0]!=0) {
+    fprintf(stderr, "Could not parse %s: '%s'.\n", what, str);
+    exit(1);
+  }
+  return value;
+}
+
+double parse_double(const char * str, const char * what) {
+  char * endptr = NULL;
+  errno = 0;
+  double value = strtod(str, &endptr);
+  if (errno || endptr==str || endptr[0]!=0) {
+    fprintf(stderr, "Could not parse %s: '%s'.\n", what, str);
+    exit(1);
+  }
+  return value;
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,28 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/** Parses a command line argument as integer. Exits with a message naming what was given if it is not one. */
+int parse_int(const char * str, const char * what);
+
+/** Parses a command line argument as floating point number. Exits with a message naming what was given if it is not one. */
+double parse_double(const char * str, const char * what);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pointset.h"
+#include "timing.h"
+
+/* Converts a pointset to the compressed pointset format, or back.
+ *
+ * The compression works best on sorted pointsets, 
+ * as consecutive points then differ by small Morton key deltas.
+ */
+
+static void usage() {
+  fprintf(stderr,"Please specify the pointset to compress (without '.vxl').\n");
+  fprintf(stderr,"Usage: pack_vxl [-u] pointset\n");
+  fprintf(stderr,"  -u Decompress 'vxl/pointset.vxlz' to 'vxl/pointset.vxl' instead.\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  bool unpack = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "u")) != -1) {
+    switch (opt) {
+      case 'u': unpack = true; break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2) usage();
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char vxl_file[length+9];
+  char vxlz_file[length+10];
+  sprintf(vxl_file, "vxl/%s.vxl", name);
+  sprintf(vxlz_file, "vxl/%s.vxlz", name);
+  const char * infile = unpack ? vxlz_file : vxl_file;
+  const char * outfile = unpack ? vxl_file : vxlz_file;
+
+  printf("[%10.0f] Converting '%s' to '%s'.\n", t.elapsed(), infile, outfile);
+  bool sorted;
+  uint64_t points;
+  {
+    pointset in(infile);
+    madvise(in.list, in.size, MADV_SEQUENTIAL);
+    pointfile out(outfile);
+    for (uint64_t i=0; i<in.length; i++) {
+      out.add(in.list[i]);
+    }
+    printf("[%10.0f] Converted %lu points.\n", t.elapsed(), in.length);
+    // The order of the points is kept, hence so is the mark that they are sorted.
+    sorted = is_sorted(infile, in.length);
+    points = in.length;
+  }
+  if (sorted) mark_sorted(outfile, true, points);
+
+  struct stat vxl_stat, vxlz_stat;
+  if (stat(vxl_file, &vxl_stat) || stat(vxlz_file, &vxlz_stat)) {perror("Could not determine file size"); exit(1);}
+  printf("[%10.0f] Compressed size is %luMiB, uncompressed size is %luMiB (%.2f bytes per point).\n", 
+         t.elapsed(), vxlz_stat.st_size>>20, vxl_stat.st_size>>20, vxl_stat.st_size ? vxlz_stat.st_size*16.0/vxl_stat.st_size : 0.0);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,65 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+int processor_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n<1 ? 1 : n;
+}
+
+namespace {
+    struct work {
+        uint64_t next;
+        uint64_t n;
+        void (*task)(uint64_t i, void * data);
+        void * data;
+    };
+    
+    void * worker(void * arg) {
+        work * w = (work*)arg;
+        for (;;) {
+            uint64_t i = __sync_fetch_and_add(&w->next, 1);
+            if (i >= w->n) break;
+            w->task(i, w->data);
+        }
+        return NULL;
+    }
+}
+
+void parallel_for(int threads, uint64_t n, void (*task)(uint64_t i, void * data), void * data) {
+    work w = {0, n, task, data};
+    if ((uint64_t)threads > n) threads = n;
+    if (threads < 1) threads = 1;
+    pthread_t thread[threads];
+    for (int i=1; i<threads; i++) {
+        int ret = pthread_create(&thread[i], NULL, worker, &w);
+        if (ret) {fprintf(stderr, "Could not create thread\n"); exit(1);}
+    }
+    worker(&w);
+    for (int i=1; i<threads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,34 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <stdint.h>
+
+/** Returns the number of processors that are currently online. */
+int processor_count();
+
+/**
+ * Calls task(i, data) for every i in [0,n), using the given number of threads.
+ * The calling thread is one of these threads.
+ * Tasks are handed out one at a time in increasing order of i.
+ * Returns when all tasks are done.
+ */
+void parallel_for(int threads, uint64_t n, void (*task)(uint64_t i, void * data), void * data);
+
+#endif
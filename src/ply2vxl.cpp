@@ -0,0 +1,439 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pointset.h"
+#include "parallel.h"
+#include "morton.h"
+#include "timing.h"
+#include "voxel_grid.h"
+#include "options.h"
+
+/* Converts the vertices of a binary little endian PLY file to binary pointset format.
+ *
+ * The file is mapped to memory and its vertices are read in parallel, 
+ * first to determine their bounds and then to convert them to points.
+ * Vertices with float or double coordinates and uchar or ushort colors are read by specialized code,
+ * other layouts are read by generic code.
+ */
+
+static const int DEFAULT_DEPTH = 20;
+static const uint64_t CHUNK = 1<<20; /// Number of vertices handled by a single task.
+
+enum type_id {INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64, INVALID};
+
+static type_id parse_type(const std::string& name) {
+  static const char * names[][2] = {
+    {"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+    {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"},
+  };
+  for (int i=0; i<INVALID; i++) {
+    if (name == names[i][0] || name == names[i][1]) return (type_id)i;
+  }
+  return INVALID;
+}
+
+static int type_size(type_id t) {
+  static const int size[] = {1, 1, 2, 2, 4, 4, 4, 8};
+  return size[t];
+}
+
+/** Reads a value of the given type from an unaligned position. */
+template<class T> static T get(const uint8_t * data) {
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+static double read_value(const uint8_t * data, type_id t) {
+  switch (t) {
+    case INT8:    return (int8_t)data[0];
+    case UINT8:   return data[0];
+    case INT16:   return get<int16_t>(data);
+    case UINT16:  return get<uint16_t>(data);
+    case INT32:   return get<int32_t>(data);
+    case UINT32:  return get<uint32_t>(data);
+    case FLOAT32: return get<float>(data);
+    case FLOAT64: return get<double>(data);
+    default:      return 0;
+  }
+}
+
+struct ply_file {
+  const uint8_t * data;
+  uint64_t size;
+  uint64_t vertices;
+  uint64_t offset; /// Position of the first vertex.
+  uint32_t stride; /// Size of a vertex.
+  type_id coord_type[3];
+  int coord_offset[3]; /// Position of the coordinates within a vertex, in the order of the output axes.
+  type_id color_type[3];
+  int color_offset[3]; /// Position of the red, green and blue values within a vertex, or -1 if absent.
+};
+
+/** Reads the next line of the header. */
+static std::string next_line(const ply_file& f, uint64_t& pos) {
+  const uint8_t * end = (const uint8_t*)memchr(f.data + pos, '\n', f.size - pos);
+  if (!end) {
+    fprintf(stderr, "PLY header is not terminated.\n");
+    exit(1);
+  }
+  std::string line((const char*)f.data + pos, end - (f.data + pos));
+  if (!line.empty() && line[line.size()-1] == '\r') line.resize(line.size()-1);
+  pos = end - f.data + 1;
+  return line;
+}
+
+/** Parses the header of the PLY file and locates the vertex properties. */
+static void parse_header(ply_file& f, bool y_up) {
+  uint64_t pos = 0;
+  if (f.size < 4 || next_line(f, pos) != "ply") {
+    fprintf(stderr, "Not a PLY file.\n");
+    exit(1);
+  }
+  bool in_vertex = false, found_vertex = false;
+  uint64_t skip = 0; /// Size of the elements preceding the vertices.
+  uint64_t element_size = 0, element_count = 0;
+  bool fixed_size = true;
+  f.vertices = 0;
+  f.stride = 0;
+  for (int i=0; i<3; i++) {
+    f.coord_offset[i] = -1;
+    f.color_offset[i] = -1;
+  }
+  static const char * coord_names[3] = {"x", "y", "z"};
+  static const char * color_names[3][2] = {{"red", "diffuse_red"}, {"green", "diffuse_green"}, {"blue", "diffuse_blue"}};
+  for (;;) {
+    std::string line = next_line(f, pos);
+    char word[64], type[64], name[64];
+    if (sscanf(line.c_str(), "%63s", word) != 1) continue;
+    std::string w(word);
+    if (w == "end_header") break;
+    if (w == "comment" || w == "obj_info") continue;
+    if (w == "format") {
+      if (sscanf(line.c_str(), "format %63s", type) != 1 || strcmp(type, "binary_little_endian")) {
+        fprintf(stderr, "Only binary little endian PLY files are supported.\n");
+        exit(1);
+      }
+    } else if (w == "element") {
+      unsigned long long count;
+      if (sscanf(line.c_str(), "element %63s %llu", name, &count) != 2) {
+        fprintf(stderr, "Invalid PLY element: '%s'.\n", line.c_str());
+        exit(1);
+      }
+      if (!found_vertex) {
+        if (!fixed_size) {
+          fprintf(stderr, "Elements with lists before the vertices are not supported.\n");
+          exit(1);
+        }
+        skip += element_size * element_count;
+      }
+      in_vertex = !found_vertex && !strcmp(name, "vertex");
+      if (in_vertex) {
+        found_vertex = true;
+        f.vertices = count;
+      }
+      element_size = 0;
+      element_count = count;
+    } else if (w == "property") {
+      if (sscanf(line.c_str(), "property %63s %63s", type, name) != 2) {
+        fprintf(stderr, "Invalid PLY property: '%s'.\n", line.c_str());
+        exit(1);
+      }
+      if (!strcmp(type, "list")) {
+        if (in_vertex) {
+          fprintf(stderr, "Vertices with list properties are not supported.\n");
+          exit(1);
+        }
+        fixed_size = false;
+        continue;
+      }
+      type_id t = parse_type(type);
+      if (t == INVALID) {
+        fprintf(stderr, "Unknown PLY type: '%s'.\n", type);
+        exit(1);
+      }
+      if (in_vertex) {
+        for (int i=0; i<3; i++) {
+          if (!strcmp(name, coord_names[i])) {
+            f.coord_type[i] = t;
+            f.coord_offset[i] = element_size;
+          }
+          if (!strcmp(name, color_names[i][0]) || !strcmp(name, color_names[i][1])) {
+            f.color_type[i] = t;
+            f.color_offset[i] = element_size;
+          }
+        }
+      }
+      element_size += type_size(t);
+      if (in_vertex) f.stride = element_size;
+    }
+  }
+  if (!found_vertex || f.coord_offset[0]<0 || f.coord_offset[1]<0 || f.coord_offset[2]<0) {
+    fprintf(stderr, "PLY file has no vertices with x, y and z coordinates.\n");
+    exit(1);
+  }
+  f.offset = pos + skip;
+  if (f.offset + f.vertices * f.stride > f.size) {
+    fprintf(stderr, "File is truncated: expected %lu vertices of %u bytes.\n", f.vertices, f.stride);
+    exit(1);
+  }
+  if (f.color_offset[0]<0 || f.color_offset[1]<0 || f.color_offset[2]<0) {
+    for (int i=0; i<3; i++) f.color_offset[i] = -1;
+  }
+  if (!y_up) {
+    // Swap the y and z axis, such that y points up.
+    std::swap(f.coord_type[1], f.coord_type[2]);
+    std::swap(f.coord_offset[1], f.coord_offset[2]);
+  }
+}
+
+/** Reads coordinates of type C. */
+template<class C> struct typed_coord {
+  static double read(const uint8_t * data, type_id) {return get<C>(data);}
+};
+struct generic_coord {
+  static double read(const uint8_t * data, type_id t) {return read_value(data, t);}
+};
+
+/** Reads 8-bit color values. */
+struct uchar_color {
+  static uint32_t read(const uint8_t * data, type_id) {return data[0];}
+};
+/** Reads 16-bit color values. */
+struct ushort_color {
+  static uint32_t read(const uint8_t * data, type_id) {return get<uint16_t>(data)>>8;}
+};
+/** Reads color values of any type, where floating point colors range from 0 to 1. */
+struct generic_color {
+  static uint32_t read(const uint8_t * data, type_id t) {
+    double v = read_value(data, t);
+    if (t == FLOAT32 || t == FLOAT64) v *= 255;
+    else if (t == UINT16 || t == INT16) v /= 256;
+    return v <= 0 ? 0 : v >= 255 ? 255 : (uint32_t)v;
+  }
+};
+/** Used when the vertices have no color. */
+struct no_color {
+  static uint32_t read(const uint8_t *, type_id) {return 0xff;}
+};
+
+struct job {
+  const ply_file * f;
+  const quantization * q;
+  uint64_t first; /// First chunk of the current batch.
+  voxel_grid * grid; /// If not NULL, the points are merged into the grid instead.
+  std::vector<std::vector<point> > chunks;
+  std::vector<double> min, max; /// Bounds per chunk.
+};
+
+template<class Coord> static void bounds_task(uint64_t i, void * data) {
+  job& j = *(job*)data;
+  const ply_file& f = *j.f;
+  uint64_t begin = (j.first + i) * CHUNK;
+  uint64_t end = std::min(f.vertices, begin + CHUNK);
+  double * min = &j.min[i*3];
+  double * max = &j.max[i*3];
+  const uint8_t * vertex = f.data + f.offset + begin * f.stride;
+  for (uint64_t k=begin; k<end; k++, vertex += f.stride) {
+    for (int a=0; a<3; a++) {
+      double v = Coord::read(vertex + f.coord_offset[a], f.coord_type[a]);
+      min[a] = std::min(min[a], v);
+      max[a] = std::max(max[a], v);
+    }
+  }
+}
+
+template<class Coord, class Color> static void convert_task(uint64_t i, void * data) {
+  job& j = *(job*)data;
+  const ply_file& f = *j.f;
+  std::vector<point>& out = j.chunks[i];
+  uint64_t begin = (j.first + i) * CHUNK;
+  uint64_t end = std::min(f.vertices, begin + CHUNK);
+  out.resize(end - begin);
+  const uint8_t * vertex = f.data + f.offset + begin * f.stride;
+  for (uint64_t k=0; k<end-begin; k++, vertex += f.stride) {
+    double coord[3];
+    for (int a=0; a<3; a++) coord[a] = Coord::read(vertex + f.coord_offset[a], f.coord_type[a]);
+    uint32_t color = 0;
+    for (int c=0; c<3; c++) color = color<<8 | Color::read(vertex + f.color_offset[c], f.color_type[c]);
+    out[k] = j.q->apply(coord, color);
+  }
+  if (j.grid) {
+    j.grid->add(out.data(), out.size());
+    out.clear();
+  }
+}
+
+typedef void (*task)(uint64_t i, void * data);
+
+template<class Coord> static task select_convert(const ply_file& f) {
+  if (f.color_offset[0] < 0) return convert_task<Coord, no_color>;
+  if (f.color_type[0] == f.color_type[1] && f.color_type[0] == f.color_type[2]) {
+    if (f.color_type[0] == UINT8) return convert_task<Coord, uchar_color>;
+    if (f.color_type[0] == UINT16) return convert_task<Coord, ushort_color>;
+  }
+  return convert_task<Coord, generic_color>;
+}
+
+/** Selects the specialized code for the layout of the vertices, if any. */
+static void select_tasks(const ply_file& f, task& bounds, task& convert) {
+  type_id t = f.coord_type[0];
+  if (t == f.coord_type[1] && t == f.coord_type[2] && t == FLOAT32) {
+    bounds = bounds_task<typed_coord<float> >;
+    convert = select_convert<typed_coord<float> >(f);
+  } else if (t == f.coord_type[1] && t == f.coord_type[2] && t == FLOAT64) {
+    bounds = bounds_task<typed_coord<double> >;
+    convert = select_convert<typed_coord<double> >(f);
+  } else {
+    bounds = bounds_task<generic_coord>;
+    convert = select_convert<generic_coord>(f);
+  }
+}
+
+static void usage() {
+  fprintf(stderr,"Please specify the file to convert (without '.ply').\n");
+  fprintf(stderr,"Usage: ply2vxl [-d depth] [-s scale] [-y] [-m] [-c] [-j threads] file\n");
+  fprintf(stderr,"  -d depth   Number of bits per coordinate of the output (default: %d).\n", DEFAULT_DEPTH);
+  fprintf(stderr,"  -s scale   Number of points per unit of the input (default: fill the range of the output).\n");
+  fprintf(stderr,"  -y         The input has y pointing up, instead of z.\n");
+  fprintf(stderr,"  -m         Merge the points in the same voxel into one point with their average color.\n");
+  fprintf(stderr,"  -c         Write the points to standard output, instead of to 'vxl/file.vxl'.\n");
+  fprintf(stderr,"  -j threads Number of threads to use (default: all processors).\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+
+  // Parse options
+  int depth = DEFAULT_DEPTH;
+  double scale = 0;
+  bool y_up = false;
+  bool merge = false;
+  bool to_stdout = false;
+  int threads = processor_count();
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:ymcj:")) != -1) {
+    switch (opt) {
+      case 'd':
+        depth = parse_int(optarg, "depth");
+        if (depth<1 || depth>MAX_DEPTH) {
+          fprintf(stderr, "Depth must be in the range [1,%d].\n", MAX_DEPTH);
+          exit(1);
+        }
+        break;
+      case 's':
+        scale = parse_double(optarg, "scale");
+        if (scale<=0) {
+          fprintf(stderr, "Scale must be positive.\n");
+          exit(1);
+        }
+        break;
+      case 'y': y_up = true; break;
+      case 'm': merge = true; break;
+      case 'c': to_stdout = true; break;
+      case 'j':
+        threads = parse_int(optarg, "number of threads");
+        if (threads<=0) threads = processor_count();
+        break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2) usage();
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char infile[length+11];
+  char outfile[length+9];
+  sprintf(infile, "input/%s.ply", name);
+  sprintf(outfile, "vxl/%s.vxl", name);
+
+  // Map the input file to memory.
+  int fd = open(infile, O_RDONLY);
+  if (fd == -1) {perror("Could not open file"); exit(1);}
+  ply_file f;
+  f.size = lseek(fd, 0, SEEK_END);
+  if (f.size == 0) {fprintf(stderr, "Not a PLY file.\n"); exit(1);}
+  f.data = (const uint8_t*)mmap(NULL, f.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (f.data == MAP_FAILED) {perror("Could not map file to memory"); exit(1);}
+  parse_header(f, y_up);
+  printf("[%10.0f] Opened '%s' with %lu vertices of %u bytes%s.\n", t.elapsed(), infile, f.vertices, f.stride, f.color_offset[0]<0 ? " without color" : "");
+  if (f.vertices == 0) {
+    fprintf(stderr, "No points found in '%s'.\n", infile);
+    exit(1);
+  }
+  task bounds, convert;
+  select_tasks(f, bounds, convert);
+
+  // Determine the bounds.
+  job j;
+  j.f = &f;
+  uint64_t chunks = (f.vertices + CHUNK - 1) / CHUNK;
+  j.first = 0;
+  j.min.assign(chunks*3, DBL_MAX);
+  j.max.assign(chunks*3, -DBL_MAX);
+  parallel_for(threads, chunks, bounds, &j);
+  double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+  double max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+  for (uint64_t i=0; i<chunks*3; i++) {
+    min[i%3] = std::min(min[i%3], j.min[i]);
+    max[i%3] = std::max(max[i%3], j.max[i]);
+  }
+  quantization q;
+  q.fit(min, max, depth, scale);
+  j.q = &q;
+  voxel_grid * grid = merge ? new voxel_grid() : NULL;
+  j.grid = grid;
+  printf("[%10.0f] Bounds: x %f - %f, y %f - %f, z %f - %f, using scale %f.\n", t.elapsed(), min[0], max[0], min[1], max[1], min[2], max[2], q.scale);
+
+  // Convert the points in batches of a few chunks per thread, writing them in order.
+  pointfile out(to_stdout ? "-" : outfile);
+  for (j.first = 0; j.first < chunks; j.first += j.chunks.size()) {
+    j.chunks.resize(std::min<uint64_t>(threads*4, chunks - j.first));
+    parallel_for(threads, j.chunks.size(), convert, &j);
+    for (uint64_t i=0; i<j.chunks.size(); i++) {
+      for (uint64_t k=0; k<j.chunks[i].size(); k++) out.add(j.chunks[i][k]);
+    }
+    uint64_t done = std::min(f.vertices, (j.first + j.chunks.size()) * CHUNK);
+    printf("[%10.0f] Converted %lu of %lu points.\n", t.elapsed(), done, f.vertices);
+  }
+  if (grid) {
+    printf("[%10.0f] Merged %lu points into %lu voxels.\n", t.elapsed(), grid->points(), grid->size());
+    grid->write(out, threads);
+    delete grid;
+  }
+  q.write(outfile);
+  munmap((void*)f.data, f.size);
+  close(fd);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
@@ -19,13 +19,34 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "pointset.h"
+#include "vxlz.h"
+#include "morton.h"
+#include "timing.h"
 
-pointset::pointset(const char* filename, bool write) : write(write) {
+pointset::pointset(const char* filename, bool write) : write(write), compressed(is_vxlz(filename)), in_memory(compressed) {
+    if (compressed) {
+        load(filename);
+        return;
+    }
+    struct stat s;
+    if (!strcmp(filename, "-") || (stat(filename, &s) == 0 && !S_ISREG(s.st_mode))) {
+        in_memory = true;
+        receive(filename);
+        return;
+    }
     if (write) {
         fd = open(filename, O_RDWR | O_CREAT, 0644);
         if (fd == -1) write = false;
@@ -41,6 +62,67 @@ pointset::pointset(const char* filename, bool write) : write(write) {
     if (list == MAP_FAILED) {perror("Could not map file to memory"); exit(1);} 
 }
 
+/** Decompresses the points of a compressed pointset into memory. */
+void pointset::load(const char* filename) {
+    vxlz_reader in(filename);
+    fd = -1;
+    length = in.length;
+    size = length * sizeof(point);
+    if (size == 0) {
+        list = (point*)MAP_FAILED;
+        return;
+    }
+    list = (point*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (list == MAP_FAILED) {perror("Could not allocate memory for points"); exit(1);}
+    uint64_t n = 0;
+    for (uint64_t i=0; i<in.index.size(); i++) {
+        if (n + in.index[i].points > length) {fprintf(stderr, "Compressed pointset contains too many points.\n"); exit(1);}
+        in.read(i, list + n);
+        n += in.index[i].points;
+    }
+    if (n != length) {fprintf(stderr, "Compressed pointset contains too few points.\n"); exit(1);}
+    int ret = mprotect(list, size, PROT_READ);
+    if (ret) {perror("Could not change read/write memory protection"); exit(1);}
+}
+
+/** Reads the points from a stream into memory, which grows as needed. */
+void pointset::receive(const char* filename) {
+    int in = strcmp(filename, "-") ? open(filename, O_RDONLY) : dup(STDIN_FILENO);
+    if (in == -1) {perror("Could not open stream"); exit(1);}
+    fd = -1;
+    uint64_t capacity = 1<<24;
+    char * data = (char*)mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {perror("Could not allocate memory for points"); exit(1);}
+    size = 0;
+    for (;;) {
+        if (size == capacity) {
+            data = (char*)mremap(data, capacity, capacity*2, MREMAP_MAYMOVE);
+            if (data == MAP_FAILED) {perror("Could not allocate memory for points"); exit(1);}
+            capacity *= 2;
+        }
+        ssize_t ret = read(in, data + size, capacity - size);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            perror("Could not read points"); 
+            exit(1);
+        }
+        if (ret == 0) break;
+        size += ret;
+    }
+    close(in);
+    if (size % sizeof(point)) {fprintf(stderr, "Stream ends with an incomplete point.\n"); exit(1);}
+    length = size / sizeof(point);
+    if (size == 0) {
+        munmap(data, capacity);
+        list = (point*)MAP_FAILED;
+        return;
+    }
+    list = (point*)mremap(data, capacity, size, 0);
+    if (list == MAP_FAILED) {perror("Could not shrink memory for points"); exit(1);}
+    int ret = mprotect(list, size, PROT_READ);
+    if (ret) {perror("Could not change read/write memory protection"); exit(1);}
+}
+
 pointset::~pointset() {
     if (list!=MAP_FAILED)
         munmap(list, size);
@@ -63,29 +145,305 @@ void pointset::enable_write(bool flag) {
     }
 }
 
+/**
+ * Shrinks the file such that only the first given number of points remain.
+ * Requires the file to be opened in write mode.
+ */
+void pointset::truncate(uint64_t new_length) {
+    assert(write && new_length <= length);
+    uint64_t new_size = new_length * sizeof(point);
+    if (!in_memory) {
+        int ret = ftruncate(fd, new_size);
+        if (ret) {perror("Could not truncate file"); exit(1);}
+    }
+    if (new_size) {
+        list = (point*)mremap(list, size, new_size, 0);
+        if (list == MAP_FAILED) {perror("Could not remap file to memory"); exit(1);}
+    } else {
+        munmap(list, size);
+        list = (point*)MAP_FAILED;
+    }
+    size = new_size;
+    length = new_length;
+}
+
+void quantization::fit(const double min[3], const double max[3], int depth, double scale) {
+    this->depth = depth;
+    double extent = 0;
+    for (int i=0; i<3; i++) {
+        offset[i] = min[i];
+        extent = std::max(extent, max[i] - min[i]);
+    }
+    double range = (1u<<depth) - 1;
+    if (scale == 0) {
+        scale = extent > 0 ? range / extent : 1;
+    } else if (extent * scale > range) {
+        fprintf(stderr, "Points span %.0f units at the given scale, which does not fit in %d bits.\n", extent * scale, depth);
+        exit(1);
+    }
+    this->scale = scale;
+}
+
+void quantization::write(const char * pointset) const {
+    char filename[strlen(pointset)+6];
+    sprintf(filename, "%s.meta", pointset);
+    FILE * f = fopen(filename, "w");
+    if (!f) {perror("Could not create metadata file"); exit(1);}
+    fprintf(f, "offset %.17g %.17g %.17g\n", offset[0], offset[1], offset[2]);
+    fprintf(f, "scale %.17g\n", scale);
+    fprintf(f, "depth %d\n", depth);
+    if (fclose(f)) {perror("Could not write metadata file"); exit(1);}
+}
+
+bool quantization::read(const char * pointset) {
+    char filename[strlen(pointset)+6];
+    sprintf(filename, "%s.meta", pointset);
+    FILE * f = fopen(filename, "r");
+    if (!f) return false;
+    int found = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "offset %lf %lf %lf", &offset[0], &offset[1], &offset[2]) == 3) found |= 1;
+        if (sscanf(line, "scale %lf", &scale) == 1) found |= 2;
+        if (sscanf(line, "depth %d", &depth) == 1) found |= 4;
+    }
+    fclose(f);
+    return found == 7;
+}
+
+bool is_sorted(const char * pointset, uint64_t length) {
+    char filename[strlen(pointset)+6];
+    sprintf(filename, "%s.meta", pointset);
+    FILE * f = fopen(filename, "r");
+    if (!f) return false;
+    bool sorted = false;
+    char line[256];
+    unsigned long n;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "sorted hilbert %lu", &n) == 1) sorted = n == length;
+    }
+    fclose(f);
+    return sorted;
+}
+
+/** Rewrites the metadata file, keeping the lines other than the mark. Does not create it if nothing needs to be marked. */
+void mark_sorted(const char * pointset, bool sorted, uint64_t length) {
+    char filename[strlen(pointset)+6];
+    sprintf(filename, "%s.meta", pointset);
+    std::vector<std::string> lines;
+    bool marked = false;
+    FILE * f = fopen(filename, "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "sorted ", 7)) {
+                lines.push_back(line);
+            } else {
+                marked = true;
+            }
+        }
+        fclose(f);
+    }
+    if (!sorted && !marked) return;
+    f = fopen(filename, "w");
+    if (!f) {perror("Could not create metadata file"); exit(1);}
+    for (uint64_t i=0; i<lines.size(); i++) fputs(lines[i].c_str(), f);
+    if (sorted) fprintf(f, "sorted hilbert %lu\n", (unsigned long)length);
+    if (fclose(f)) {perror("Could not write metadata file"); exit(1);}
+}
+
+bool check_sorted(Timer& t, const pointset& in) {
+    printf("[%10.0f] Checking if %lu points are sorted.\n", t.elapsed(), in.length);
+    uint64_t old = 0;
+    for (uint64_t i=0; i<in.length; i++) {
+        if (i && (i&0x3fffff)==0) {
+            printf("[%10.0f] Checking ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
+        }
+        uint64_t cur = hilbert3d(in.list[i]);
+        if (old>cur) {
+            printf("[%10.0f] Point %lu should precede previous point.\n", t.elapsed(), i);
+            return false;
+        }
+        old = cur;
+    }
+    return true;
+}
+
 static const int point_buffer_size = 1<<16;
+static const int point_buffer_count = 4;
+
+/** 
+ * Writes the buffers that are queued by a pointfile at consecutive offsets. 
+ * The buffers are returned to the pool afterwards.
+ */
+struct pointfile::writer {
+    int32_t fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    std::vector<point*> pool; /// Buffers that are free to be filled.
+    int buffers; /// Number of buffers allocated, which grows up to point_buffer_count when writing falls behind.
+    std::deque<std::pair<point*, int> > queue; /// Buffers and their number of points that are to be written.
+    bool done;
+    int error; /// Error number of the first write that failed.
+    uint64_t offset;
+    bool sequential; /// Whether the file is a stream, which does not support writing at an offset.
+    bool compressed;
+    std::vector<uint8_t> encoded; /// Block that is being written to a compressed pointset.
+    std::vector<vxlz_block> index; /// Blocks written to a compressed pointset.
+    uint64_t points;
+
+    static void * run(void * arg) {
+        writer * w = (writer*)arg;
+        pthread_mutex_lock(&w->lock);
+        for (;;) {
+            while (w->queue.empty() && !w->done) pthread_cond_wait(&w->changed, &w->lock);
+            if (w->queue.empty()) break;
+            std::pair<point*, int> item = w->queue.front();
+            w->queue.pop_front();
+            pthread_mutex_unlock(&w->lock);
+            int error = w->write_points(item.first, item.second);
+            pthread_mutex_lock(&w->lock);
+            if (error && !w->error) w->error = error;
+            w->pool.push_back(item.first);
+            pthread_cond_broadcast(&w->changed);
+        }
+        pthread_mutex_unlock(&w->lock);
+        return NULL;
+    }
+
+    /** Writes the given points, compressing them if needed. Returns the error number on failure. */
+    int write_points(const point * list, int n) {
+        points += n;
+        if (!compressed) return write(list, n * sizeof(point));
+        vxlz_encode(list, n, encoded);
+        vxlz_block b = {offset, (uint32_t)encoded.size(), (uint32_t)n};
+        index.push_back(b);
+        return write(&encoded[0], encoded.size());
+    }
+
+    /** Writes the given bytes at the current offset. Returns the error number on failure. */
+    int write(const void * data, uint64_t size) {
+        const char * bytes = (const char*)data;
+        while (size) {
+            ssize_t ret = sequential ? ::write(fd, bytes, size) : pwrite(fd, bytes, size, offset);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            if (ret == 0) return EIO;
+            bytes += ret;
+            size -= ret;
+            offset += ret;
+        }
+        return 0;
+    }
+
+    /** Exits if any write failed. Requires the lock to be held. */
+    void check() {
+        if (error) {
+            errno = error;
+            perror("Could not write points");
+            exit(1);
+        }
+    }
+};
+
+static point * allocate_buffer() {
+    void * b;
+    if (posix_memalign(&b, 1<<12, point_buffer_size * sizeof(point))) {
+        fprintf(stderr, "Could not allocate file buffer\n");
+        exit(1);
+    }
+    return (point*)b;
+}
+
 pointfile::pointfile(const char* filename) {
-    fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+    if (strcmp(filename, "-")) {
+        mark_sorted(filename, false);
+        fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+    } else {
+        fd = dup(STDOUT_FILENO);
+        // Text that is still buffered by stdio is flushed to standard error as well.
+        if (fd != -1) dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
     if (fd == -1) {perror("Could not open/create file"); exit(1);}
-    buffer = new point[point_buffer_size];
-    if (!buffer) {
-        fprintf(stderr, "Could not allocate larger file buffer");
+    struct stat s;
+    if (fstat(fd, &s)) {perror("Could not open/create file"); exit(1);}
+    io = new writer();
+    io->fd = fd;
+    io->sequential = !S_ISREG(s.st_mode);
+    io->done = false;
+    io->error = 0;
+    io->offset = 0;
+    io->points = 0;
+    io->compressed = is_vxlz(filename);
+    if (io->compressed) {
+        vxlz_header header = {VXLZ_MAGIC, VXLZ_VERSION};
+        io->error = io->write(&header, sizeof(header));
     }
+    io->buffers = 1;
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->changed, NULL);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 1<<16);
+    int ret = pthread_create(&io->thread, &attr, writer::run, io);
+    pthread_attr_destroy(&attr);
+    if (ret) {fprintf(stderr, "Could not create thread\n"); exit(1);}
+    buffer = allocate_buffer();
     cnt = 0;
 }
 
 pointfile::~pointfile() {
-    write(fd, buffer, cnt * sizeof(point));
-    free(buffer);
+    pthread_mutex_lock(&io->lock);
+    if (cnt) io->queue.push_back(std::make_pair(buffer, cnt));
+    else io->pool.push_back(buffer);
+    io->done = true;
+    pthread_cond_broadcast(&io->changed);
+    pthread_mutex_unlock(&io->lock);
+    pthread_join(io->thread, NULL);
+    if (io->compressed && !io->error) {
+        vxlz_footer footer = {io->points, io->index.size(), io->offset, VXLZ_VERSION, VXLZ_MAGIC};
+        if (!io->index.empty()) io->error = io->write(&io->index[0], io->index.size() * sizeof(vxlz_block));
+        if (!io->error) io->error = io->write(&footer, sizeof(footer));
+    }
+    io->check();
+    for (size_t i=0; i<io->pool.size(); i++) free(io->pool[i]);
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->changed);
+    delete io;
     if (fd!=-1)
         close(fd);
 }
 
+/** 
+ * Queues the current buffer for writing and continues with a free buffer. 
+ * Waits for a buffer to be written if all buffers are in use.
+ */
+void pointfile::flush() {
+    pthread_mutex_lock(&io->lock);
+    io->queue.push_back(std::make_pair(buffer, cnt));
+    pthread_cond_broadcast(&io->changed);
+    if (io->pool.empty() && io->buffers < point_buffer_count) {
+        io->check();
+        io->buffers++;
+        pthread_mutex_unlock(&io->lock);
+        buffer = allocate_buffer();
+        cnt = 0;
+        return;
+    }
+    while (io->pool.empty() && !io->error) pthread_cond_wait(&io->changed, &io->lock);
+    io->check();
+    buffer = io->pool.back();
+    io->pool.pop_back();
+    pthread_mutex_unlock(&io->lock);
+    cnt = 0;
+}
+
 void pointfile::add(const point& p) {
     buffer[cnt] = p;
     cnt++;
-    if (cnt >= point_buffer_size) {
-        write(fd, buffer, point_buffer_size * sizeof(point));
-        cnt = 0;
-    }
+    if (cnt >= point_buffer_size) flush();
 }
+
@@ -20,6 +20,8 @@
 #define POINTSET_H
 #include <stdint.h>
 
+struct Timer;
+
 struct point {
     uint32_t x,y,z,c;
     point() {}
@@ -31,28 +33,94 @@ struct point {
  * Can also be opened in write mode for transforming or sorting the points.
  * Write access must be enabled before the data can be modified.
  * Points cannot be added or removed.
+ * A compressed pointset ('.vxlz') is decompressed into memory, hence modifications are not written back.
+ * The same holds for a stream, such as a pipe or FIFO, which is read into memory until it ends.
+ * The file name '-' denotes standard input.
  */
 struct pointset {
     bool write;
-    uint32_t size; /// Number of bytes in the pointfile.
-    uint32_t length; /// Number of points in the pointfile.
+    bool compressed;
+    bool in_memory; /// Whether the points were loaded into memory, instead of being mapped.
+    uint64_t size; /// Number of bytes in the pointfile.
+    uint64_t length; /// Number of points in the pointfile.
     int32_t fd;
     point * list;
     pointset(const char* filename, bool write=false);
     ~pointset();
     void enable_write(bool flag);
+    void truncate(uint64_t length);
+private:
+    void load(const char* filename);
+    void receive(const char* filename);
+};
+
+/**
+ * Maps input coordinates to the coordinates of a pointset, by (input - offset) * scale.
+ * The same scale is used for all axes, such that the model is not distorted.
+ * Converters store it next to the pointset, in 'pointset.vxl.meta', such that the 
+ * original coordinates can be recovered.
+ */
+struct quantization {
+    double offset[3];
+    double scale;
+    int depth; /// Number of bits per coordinate.
+    /**
+     * Chooses the offset and scale such that the given bounds fill the range [0, 2^depth) along their largest axis.
+     * If scale is non-zero it is used instead, for inputs with a fixed precision.
+     * Exits if the points do not fit.
+     */
+    void fit(const double min[3], const double max[3], int depth, double scale=0);
+    /** Rounds the given coordinates to the nearest point, clamping them to the bounds that were fit. */
+    point apply(const double coord[3], uint32_t color) const {
+        point p;
+        uint32_t * v = &p.x;
+        uint32_t limit = (1u<<depth)-1;
+        for (int i=0; i<3; i++) {
+            double q = (coord[i] - offset[i]) * scale;
+            v[i] = q <= 0 ? 0 : q >= limit ? limit : (uint32_t)(q + 0.5);
+        }
+        p.c = color;
+        return p;
+    }
+    /** Writes the quantization to the metadata file of the given pointset file. */
+    void write(const char * pointset) const;
+    /** Reads the quantization from the metadata file of the given pointset file. Returns false if it has none. */
+    bool read(const char * pointset);
 };
 
+/**
+ * The metadata file also marks whether a pointset is sorted along the hilbert curve, by the line 'sorted hilbert n',
+ * with n the number of points. This allows build_db to skip checking and sorting the points.
+ * Opening a pointfile removes the mark, as the file is rewritten.
+ */
+/** Returns whether the given pointset file, containing the given number of points, is marked as sorted. */
+bool is_sorted(const char * pointset, uint64_t length);
+/** Marks the given pointset file as sorted, or removes the mark if it is not. */
+void mark_sorted(const char * pointset, bool sorted, uint64_t length=0);
+/** Checks whether the points are sorted along the hilbert curve, reporting the progress and the first point that is not. */
+bool check_sorted(Timer& t, const pointset& in);
+
 /**
  * Opens a file for writing out points.
+ * Full buffers are written by a background thread, such that adding points does not wait for the disk.
+ * If the file name ends with '.vxlz', each buffer is written as a compressed block, see vxlz.h.
+ * The file name '-' denotes standard output, which is then redirected to standard error,
+ * such that messages printed by the program do not end up between the points.
+ * Exits if writing fails.
  */
 struct pointfile {
     int32_t fd;
-    point * buffer;
+    point * buffer; /// Buffer that is being filled.
     int cnt;
     pointfile(const char* filename);
     ~pointfile();
     void add(const point &p);
+private:
+    struct writer;
+    writer * io;
+    void flush();
+    pointfile(const pointfile&);
+    pointfile& operator=(const pointfile&);
 };
 
 #endif
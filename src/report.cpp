@@ -0,0 +1,123 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <sys/resource.h>
+
+#include "report.h"
+
+report::report() {}
+
+/** 
+ * Samples the resource usage of the process, including all its threads.
+ * Storage I/O is measured in blocks of 512 bytes, hence includes the pages read through mmap.
+ */
+usage report::sample() {
+    usage u;
+    rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    u.wall = t.elapsed();
+    u.user = r.ru_utime.tv_sec*1000.0 + r.ru_utime.tv_usec/1000.0;
+    u.system = r.ru_stime.tv_sec*1000.0 + r.ru_stime.tv_usec/1000.0;
+    u.read = r.ru_inblock * 512ull;
+    u.written = r.ru_oublock * 512ull;
+    u.minor_faults = r.ru_minflt;
+    u.major_faults = r.ru_majflt;
+    u.peak_rss = r.ru_maxrss * 1024ull;
+    return u;
+}
+
+void report::stage(const char* name, uint64_t items) {
+    finish();
+    stage_data s;
+    s.name = name;
+    s.items = items;
+    s.done = false;
+    s.begin = s.end = sample();
+    stages.push_back(s);
+}
+
+void report::finish() {
+    if (!stages.empty() && !stages.back().done) {
+        stages.back().end = sample();
+        stages.back().done = true;
+    }
+}
+
+void report::put(const char* key, const std::string& json) {
+    for (size_t i=0; i<values.size(); i++) {
+        if (values[i].first == key) {
+            values[i].second = json;
+            return;
+        }
+    }
+    values.push_back(std::make_pair(key, json));
+}
+
+void report::set(const char* key, const char* value) {
+    std::string v = "\"";
+    for (const char * c = value; *c; c++) {
+        if (*c=='"' || *c=='\\') v += '\\';
+        v += *c;
+    }
+    put(key, v + "\"");
+}
+
+void report::set(const char* key, uint64_t value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu", value);
+    put(key, buf);
+}
+
+void report::set(const char* key, const uint64_t* value, int n) {
+    std::string v = "[";
+    for (int i=0; i<n; i++) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), i?", %lu":"%lu", value[i]);
+        v += buf;
+    }
+    put(key, v + "]");
+}
+
+bool report::write(const char* filename) {
+    finish();
+    FILE * f = fopen(filename, "w");
+    if (!f) {perror("Could not open report file"); return false;}
+    usage total = sample();
+    fprintf(f, "{\n");
+    for (size_t i=0; i<values.size(); i++) {
+        fprintf(f, "  \"%s\": %s,\n", values[i].first.c_str(), values[i].second.c_str());
+    }
+    fprintf(f, "  \"wall_ms\": %.3f,\n  \"user_ms\": %.3f,\n  \"system_ms\": %.3f,\n  \"peak_rss_bytes\": %lu,\n", total.wall, total.user, total.system, total.peak_rss);
+    fprintf(f, "  \"stages\": [");
+    for (size_t i=0; i<stages.size(); i++) {
+        const stage_data& s = stages[i];
+        double wall = s.end.wall - s.begin.wall;
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"wall_ms\": %.3f, \"user_ms\": %.3f, \"system_ms\": %.3f, ", i?",":"", s.name.c_str(), wall, s.end.user - s.begin.user, s.end.system - s.begin.system);
+        fprintf(f, "\"items\": %lu, \"items_per_s\": %.1f, ", s.items, wall>0 ? s.items*1000.0/wall : 0.0);
+        fprintf(f, "\"read_bytes\": %lu, \"written_bytes\": %lu, ", s.end.read - s.begin.read, s.end.written - s.begin.written);
+        fprintf(f, "\"minor_faults\": %lu, \"major_faults\": %lu, \"peak_rss_bytes\": %lu}", s.end.minor_faults - s.begin.minor_faults, s.end.major_faults - s.begin.major_faults, s.end.peak_rss);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    bool ok = !ferror(f);
+    if (fclose(f)) ok = false;
+    if (!ok) perror("Could not write report file");
+    return ok;
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,68 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPORT_H
+#define REPORT_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+/** Resource usage of the process since it started. */
+struct usage {
+    double wall, user, system; /// Time in milliseconds.
+    uint64_t read, written; /// Bytes read from and written to storage.
+    uint64_t minor_faults, major_faults;
+    uint64_t peak_rss; /// Maximum resident set size in bytes.
+};
+
+/**
+ * Records the resource usage of the consecutive stages of a program, 
+ * together with some named values, and writes them to a JSON file.
+ * 
+ * A stage lasts until the next stage is started or the report is finished.
+ */
+struct report {
+    report();
+    /** Starts a new stage, which processes the given number of items. */
+    void stage(const char * name, uint64_t items=0);
+    /** Ends the current stage. */
+    void finish();
+    /** Sets a named value, replacing the previous value with the same name. */
+    void set(const char * key, const char * value);
+    void set(const char * key, uint64_t value);
+    void set(const char * key, const uint64_t * values, int n);
+    /** Writes the report to the given file. Returns false on failure. */
+    bool write(const char * filename);
+private:
+    struct stage_data {
+        std::string name;
+        uint64_t items;
+        bool done;
+        usage begin, end;
+    };
+    report(const report&);
+    usage sample();
+    void put(const char * key, const std::string& json);
+    Timer t;
+    std::vector<stage_data> stages;
+    std::vector<std::pair<std::string, std::string> > values;
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "octree.h"
+#include "timing.h"
+
+/* Combines the octrees built from the tiles created by tile into a single octree.
+ * 
+ * The nodes of the tiles are copied to the output, with their child indices rebased. 
+ * The nodes in the layers above the tiles are then rebuilt from the tile nodes at the layer at which 
+ * the points were split. The nodes above that layer in the tile files are replaced by these, 
+ * hence they are skipped while copying.
+ * 
+ * Tiles are read from '.oct64' files if their '.oct' file does not exist. If the result does not fit 
+ * in 32-bit indices, it is written to 'vxl/name.oct64' instead of 'vxl/name.oct'.
+ */
+
+/** A node or leaf of a tile that must be linked into the layers above the tiles. */
+struct item {
+  int level;
+  uint64_t prefix; /// Path from the root to the node, three bits per layer.
+  uint64_t index; /// Index of the node in the output, or ~0 if it is a leaf.
+  int32_t color;
+};
+
+/** A tile listed in the manifest. */
+struct tile_file {
+  std::string name;
+  uint64_t nodes; /// Number of nodes in the file.
+  uint64_t offset; /// Index of its first node in the output.
+  std::vector<uint64_t> skipped; /// Sorted indices of the nodes above the split layer, which are not copied.
+  /** Returns the index in the output of the node at the given index in the file. */
+  uint64_t rebase(uint64_t index) const {
+    return offset + index - (std::lower_bound(skipped.begin(), skipped.end(), index) - skipped.begin());
+  }
+};
+
+/** Collects the nodes and leaves at the split layer below the given node, and the nodes above it. */
+static void collect(const octree_file& in, uint64_t index, int level, uint64_t prefix, int split, tile_file& tile, std::vector<item>& items) {
+  tile.skipped.push_back(index);
+  octree64 n = in.node(index);
+  for (int i=0; i<8; i++) {
+    if (n.avgcolor[i]<0) continue;
+    item it = {level-1, prefix<<3|i, n.child[i], n.avgcolor[i]};
+    if (level-1 == split || !~n.child[i]) {
+      items.push_back(it);
+    } else {
+      collect(in, n.child[i], level-1, it.prefix, split, tile, items);
+    }
+  }
+}
+
+typedef std::map<std::pair<int,uint64_t>, octree64> top_layers;
+
+/** Links a node or leaf into its parent, creating the parent and its ancestors up to the root if necessary. */
+static void link(top_layers& top, int layers, const item& it) {
+  for (int l = it.level+1; l <= layers; l++) {
+    std::pair<int,uint64_t> key(l, it.prefix>>(l-it.level)*3);
+    if (top.count(key)) continue;
+    clear(top[key]);
+  }
+  octree64& parent = top[std::make_pair(it.level+1, it.prefix>>3)];
+  int idx = it.prefix&7;
+  if (parent.avgcolor[idx]>=0) {
+    fprintf(stderr, "Tiles overlap at layer %d. Use fewer tiles or prune fewer layers.\n", it.level);
+    exit(1);
+  }
+  parent.child[idx] = it.index;
+  parent.avgcolor[idx] = it.color;
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  if (argc != 2) {
+    fprintf(stderr,"Please specify the name of the tiled point set (without '.tiles').\n");
+    exit(2);
+  }
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char manifest[length+11];
+  char outfile[length+11];
+  sprintf(manifest, "vxl/%s.tiles", name);
+  
+  // Read the manifest.
+  FILE * f = fopen(manifest, "r");
+  if (!f) {perror("Could not open manifest"); exit(1);}
+  int tiles, layers, split;
+  if (fscanf(f, "tiles %d layers %d level %d\n", &tiles, &layers, &split) != 3 || split>=layers) {
+    fprintf(stderr, "Invalid manifest '%s'.\n", manifest);
+    exit(1);
+  }
+  
+  // Collect the nodes of the tiles at the split layer, at the index they will have in the output.
+  printf("[%10.0f] Reading %d tiles at layer %d.\n", t.elapsed(), tiles, split);
+  std::vector<tile_file> files(tiles);
+  std::vector<item> items;
+  uint64_t nodes = 1;
+  int pruned = -1;
+  for (int j=0; j<tiles; j++) {
+    char tile[256];
+    int tile_layers;
+    unsigned long points;
+    if (fscanf(f, "%255s %d %lu\n", tile, &tile_layers, &points) != 3) {
+      fprintf(stderr, "Invalid manifest '%s'.\n", manifest);
+      exit(1);
+    }
+    char infile[strlen(tile)+11];
+    sprintf(infile, "vxl/%s.oct", tile);
+    if (access(infile, F_OK)) sprintf(infile, "vxl/%s.oct64", tile);
+    // The tiles must have been built with the same number of pruned layers.
+    int tile_pruned = read_pruned_layers(infile);
+    if (j>0 && tile_pruned != pruned) {
+      fprintf(stderr, "Tile '%s' was built with a different number of pruned layers.\n", infile);
+      exit(1);
+    }
+    pruned = tile_pruned;
+    octree_file in(infile);
+    files[j].name = infile;
+    files[j].nodes = in.nodes();
+    files[j].offset = nodes;
+    if (tile_layers <= split) {
+      item it = {tile_layers, 0, nodes, (int32_t)average(in.node(0))};
+      items.push_back(it);
+    } else {
+      uint64_t first = items.size();
+      collect(in, 0, tile_layers, 0, split, files[j], items);
+      std::sort(files[j].skipped.begin(), files[j].skipped.end());
+      for (uint64_t i=first; i<items.size(); i++) {
+        if (~items[i].index) items[i].index = files[j].rebase(items[i].index);
+      }
+    }
+    nodes += files[j].nodes - files[j].skipped.size();
+  }
+  fclose(f);
+  
+  // Rebuild the layers above the split layer, which are placed after the tiles.
+  printf("[%10.0f] Building top layers from %lu nodes.\n", t.elapsed(), items.size());
+  top_layers top;
+  for (uint64_t i=0; i<items.size(); i++) {
+    link(top, layers, items[i]);
+  }
+  // The map is ordered by layer, hence children are handled before their parents.
+  uint64_t offset = nodes;
+  for (top_layers::iterator it = top.begin(); it != top.end(); ++it) {
+    if (it->first.first == layers) continue;
+    item node = {it->first.first, it->first.second, nodes++, (int32_t)average(it->second)};
+    link(top, layers, node);
+  }
+  
+  // Use 64-bit indices if the result needs them.
+  bool wide = nodes >= ~0u;
+  sprintf(outfile, wide ? "vxl/%s.oct64" : "vxl/%s.oct", name);
+  printf("[%10.0f] Writing %lu nodes%s to '%s'.\n", t.elapsed(), nodes, wide ? " with 64-bit indices" : "", outfile);
+  octree_writer out(outfile);
+  for (int j=0; j<tiles; j++) {
+    octree_file in(files[j].name.c_str());
+    const std::vector<uint64_t>& skipped = files[j].skipped;
+    printf("[%10.0f] Copying %lu nodes from '%s'.\n", t.elapsed(), files[j].nodes - skipped.size(), files[j].name.c_str());
+    assert(out.nodes == files[j].offset);
+    uint64_t s = 0;
+    for (uint64_t i=0; i<files[j].nodes; i++) {
+      if (s < skipped.size() && skipped[s] == i) {
+        s++;
+        continue;
+      }
+      octree64 n = in.node(i);
+      for (int k=0; k<8; k++) {
+        if (~n.child[k]) n.child[k] = files[j].rebase(n.child[k]);
+      }
+      out.add(n);
+    }
+  }
+  for (top_layers::iterator it = top.begin(); it != top.end(); ++it) {
+    if (it->first.first == layers) continue;
+    out.add(it->second);
+  }
+  assert(out.nodes == nodes);
+  out.set_root(top[std::make_pair(layers, (uint64_t)0)]);
+  if (pruned >= 0) write_pruned_layers(outfile, pruned);
+  printf("[%10.0f] Wrote %lu nodes, of which %lu in the top layers.\n", t.elapsed(), out.nodes, out.nodes - offset + 1);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,111 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "text_converter.h"
+#include "pointset.h"
+#include "parallel.h"
+#include "morton.h"
+#include "voxel_grid.h"
+#include "options.h"
+
+static const int DEFAULT_DEPTH = 20;
+
+static void usage(const text_format& format) {
+    fprintf(stderr,"Please specify the file to convert (without '%s').\n", format.extension);
+    fprintf(stderr,"Usage: %s [-d depth] [-s scale] [-m] [-c] file\n", format.program);
+    fprintf(stderr,"  -d depth Number of bits per coordinate of the output (default: %d).\n", DEFAULT_DEPTH);
+    fprintf(stderr,"  -s scale Number of points per unit of the input (default: fill the range of the output).\n");
+    fprintf(stderr,"  -m       Merge the points in the same voxel into one point with their average color.\n");
+    fprintf(stderr,"  -c       Write the points to standard output, instead of to 'vxl/file.vxl'.\n");
+    exit(2);
+}
+
+void convert_text(int argc, char ** argv, const text_format& format) {
+    // Parse options
+    int depth = DEFAULT_DEPTH;
+    double scale = 0;
+    bool merge = false;
+    bool to_stdout = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:s:mc")) != -1) {
+        switch (opt) {
+            case 'd':
+                depth = parse_int(optarg, "depth");
+                if (depth<1 || depth>MAX_DEPTH) {
+                    fprintf(stderr, "Depth must be in the range [1,%d].\n", MAX_DEPTH);
+                    exit(1);
+                }
+                break;
+            case 's':
+                scale = parse_double(optarg, "scale");
+                if (scale<=0) {
+                    fprintf(stderr, "Scale must be positive.\n");
+                    exit(1);
+                }
+                break;
+            case 'm': merge = true; break;
+            case 'c': to_stdout = true; break;
+            default: usage(format);
+        }
+    }
+    argc -= optind-1;
+    argv += optind-1;
+    if (argc != 2) usage(format);
+
+    // Determine the file names.
+    char * name = argv[1];
+    int length=strlen(name);
+    char infile[length+strlen(format.extension)+7];
+    char outfile[length+9];
+    sprintf(infile, "input/%s%s", name, format.extension);
+    sprintf(outfile, "vxl/%s.vxl", name);
+
+    // Find the bounds of the points, skipping the header.
+    textfile in(infile);
+    uint64_t start = in.skip_lines(format.header_lines);
+    int threads = processor_count();
+    text_bounds bounds = in.find_bounds(start, threads, format.coordinates, NULL);
+    if (bounds.points == 0) {
+        fprintf(stderr,"No points found in '%s'.\n", infile);
+        exit(1);
+    }
+    quantization q;
+    q.fit(bounds.min, bounds.max, depth, scale);
+    fprintf(stderr,"x: %f - %f\n", bounds.min[0], bounds.max[0]);
+    fprintf(stderr,"y: %f - %f\n", bounds.min[2], bounds.max[2]);
+    fprintf(stderr,"z: %f - %f\n", bounds.min[1], bounds.max[1]);
+    fprintf(stderr,"offset: %f %f %f, scale: %f\n", q.offset[0], q.offset[2], q.offset[1], q.scale);
+
+    // Do the conversion
+    pointfile out(to_stdout ? "-" : outfile);
+    voxel_grid grid;
+    text_stats stats = in.parse_points(start, threads, format.parse, &q, out, merge ? &grid : NULL);
+    if (merge) {
+        fprintf(stderr,"voxels: %lu\n", grid.size());
+        grid.write(out, threads);
+    }
+    q.write(outfile);
+    fprintf(stderr,"lines: %lu, points: %lu\n", stats.lines, stats.points);
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
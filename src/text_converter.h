@@ -0,0 +1,45 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXT_CONVERTER_H
+#define TEXT_CONVERTER_H
+#include <stdint.h>
+
+#include "textfile.h"
+
+/**
+ * Describes the format of a text file of points, which differs between the text converters.
+ * The parsers read the coordinates with the y and z axis swapped, as the inputs have z pointing up.
+ */
+struct text_format {
+    const char * program; /// Name of the converter, used in its usage message.
+    const char * extension; /// Extension of the input files, such as '.txt'.
+    uint64_t header_lines; /// Number of lines preceding the points.
+    coordinate_parser coordinates;
+    line_parser parse; /// Is passed the quantization that was fit to the bounds of the points.
+};
+
+/**
+ * Runs a text converter with the given command line arguments.
+ * Converts 'input/file.ext' to 'vxl/file.vxl', or to standard output with '-c', and writes its metadata.
+ * The quantization is fit to the bounds of the points, which are found in a first pass.
+ * Exits if the arguments or the input are invalid.
+ */
+void convert_text(int argc, char ** argv, const text_format& format);
+
+#endif
@@ -0,0 +1,341 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "textfile.h"
+#include "parallel.h"
+#include "voxel_grid.h"
+
+static inline bool is_separator(char c) {
+    return c==' ' || c=='\t' || c==',' || c=='\r';
+}
+
+static inline bool is_digit(char c) {
+    return (unsigned char)(c-'0') < 10;
+}
+
+static inline int hex_digit(char c) {
+    if (is_digit(c)) return c-'0';
+    c |= 0x20;
+    if (c>='a' && c<='f') return c-'a'+10;
+    return -1;
+}
+
+/** Moves the cursor to the start of the next field. Returns false if there is none. */
+static inline bool next_field(text_cursor& c) {
+    while (c.pos<c.end && is_separator(*c.pos)) c.pos++;
+    return c.pos<c.end;
+}
+
+/** Returns whether the cursor is at the end of a field. */
+static inline bool field_end(const text_cursor& c) {
+    return c.pos==c.end || is_separator(*c.pos);
+}
+
+static inline bool read_sign(text_cursor& c) {
+    if (*c.pos=='-') {c.pos++; return true;}
+    if (*c.pos=='+') c.pos++;
+    return false;
+}
+
+bool text_cursor::read_uint(uint32_t& value) {
+    if (!next_field(*this) || !is_digit(*pos)) return false;
+    uint32_t v = 0;
+    while (pos<end && is_digit(*pos)) v = v*10 + (*pos++ - '0');
+    value = v;
+    return field_end(*this);
+}
+
+bool text_cursor::read_int(int64_t& value) {
+    if (!next_field(*this)) return false;
+    bool negative = read_sign(*this);
+    if (pos==end || !is_digit(*pos)) return false;
+    int64_t v = 0;
+    while (pos<end && is_digit(*pos)) v = v*10 + (*pos++ - '0');
+    value = negative ? -v : v;
+    return field_end(*this);
+}
+
+bool text_cursor::read_hex(uint32_t& value) {
+    if (!next_field(*this)) return false;
+    if (end-pos>2 && pos[0]=='0' && (pos[1]|0x20)=='x') pos+=2;
+    if (pos==end || hex_digit(*pos)<0) return false;
+    uint32_t v = 0;
+    int d;
+    while (pos<end && (d = hex_digit(*pos))>=0) {
+        v = v<<4 | d;
+        pos++;
+    }
+    value = v;
+    return field_end(*this);
+}
+
+/**
+ * The digits are collected into an integer, which is divided by a power of ten.
+ * As both are exactly representable for up to 15 digits, this gives the correctly rounded result, like strtod.
+ * Longer numbers are handed to strtod.
+ */
+bool text_cursor::read_decimal(double& value) {
+    static const double POW10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,1e12,1e13,1e14,1e15};
+    if (!next_field(*this)) return false;
+    const char * start = pos;
+    bool negative = read_sign(*this);
+    int64_t v = 0;
+    int digits = 0, decimals = 0;
+    while (pos<end && is_digit(*pos)) {v = v*10 + (*pos++ - '0'); digits++;}
+    if (pos<end && *pos=='.') {
+        pos++;
+        while (pos<end && is_digit(*pos)) {v = v*10 + (*pos++ - '0'); digits++; decimals++;}
+    }
+    if (digits==0) return false;
+    if (digits > 15) {
+        char buffer[64];
+        size_t length = std::min<size_t>(pos-start, sizeof(buffer)-1);
+        memcpy(buffer, start, length);
+        buffer[length] = 0;
+        value = strtod(buffer, NULL);
+    } else {
+        value = (negative ? -v : v) / POW10[decimals];
+    }
+    return field_end(*this);
+}
+
+bool text_cursor::read_fixed(int64_t& value, int decimals) {
+    if (!next_field(*this)) return false;
+    bool negative = read_sign(*this);
+    int64_t v = 0;
+    int digits = 0;
+    while (pos<end && is_digit(*pos)) {v = v*10 + (*pos++ - '0'); digits++;}
+    int d = 0;
+    if (pos<end && *pos=='.') {
+        pos++;
+        for (; pos<end && is_digit(*pos); pos++, digits++) {
+            if (d<decimals) {v = v*10 + (*pos - '0'); d++;}
+        }
+    }
+    if (digits==0) return false;
+    for (; d<decimals; d++) v *= 10;
+    value = negative ? -v : v;
+    return field_end(*this);
+}
+
+bool text_cursor::skip() {
+    if (!next_field(*this)) return false;
+    while (pos<end && !is_separator(*pos)) pos++;
+    return true;
+}
+
+textfile::textfile(const char* filename) {
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {perror("Could not open file"); exit(1);}
+    size = lseek(fd, 0, SEEK_END);
+    data = NULL;
+    if (size) {
+        data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {perror("Could not map file to memory"); exit(1);}
+        madvise((void*)data, size, MADV_SEQUENTIAL);
+    }
+}
+
+textfile::~textfile() {
+    if (data)
+        munmap((void*)data, size);
+    if (fd!=-1)
+        close(fd);
+}
+
+uint64_t textfile::skip_lines(uint64_t lines) const {
+    uint64_t offset = 0;
+    for (uint64_t i=0; i<lines && offset<size; i++) {
+        const char * newline = (const char*)memchr(data+offset, '\n', size-offset);
+        offset = newline ? newline-data+1 : size;
+    }
+    return offset;
+}
+
+static const uint64_t CHUNK_SIZE = 1<<24;
+
+namespace {
+    struct chunk {
+        const char * begin;
+        const char * end;
+        std::vector<point> points;
+        text_stats stats;
+        text_bounds bounds;
+    };
+
+    struct job {
+        const char * data;
+        uint64_t size;
+        line_parser parse;
+        coordinate_parser parse_coordinates;
+        void * arg;
+        voxel_grid * grid;
+        std::vector<chunk> chunks;
+        /** Divides the text following the given offset into chunks. Returns the number of chunks. */
+        uint64_t split(uint64_t& offset) {
+            uint64_t n = 0;
+            for (; n<chunks.size() && offset<size; n++) {
+                uint64_t next = std::min(offset + CHUNK_SIZE, size);
+                const char * newline = (const char*)memchr(data+next, '\n', size-next);
+                next = newline ? newline-data+1 : size;
+                chunks[n].begin = data + offset;
+                chunks[n].end = data + next;
+                offset = next;
+            }
+            return n;
+        }
+    };
+
+    void parse_task(uint64_t i, void * arg) {
+        job& j = *(job*)arg;
+        chunk& c = j.chunks[i];
+        c.points.clear();
+        c.stats.lines = 0;
+        c.stats.min = point(~0u, ~0u, ~0u, 0);
+        c.stats.max = point(0, 0, 0, 0);
+        const char * line = c.begin;
+        while (line < c.end) {
+            const char * newline = (const char*)memchr(line, '\n', c.end-line);
+            text_cursor cursor = {line, newline ? newline : c.end};
+            point p;
+            if (j.parse(cursor, p, j.arg)) {
+                c.points.push_back(p);
+                c.stats.min.x = std::min(c.stats.min.x, p.x);
+                c.stats.min.y = std::min(c.stats.min.y, p.y);
+                c.stats.min.z = std::min(c.stats.min.z, p.z);
+                c.stats.max.x = std::max(c.stats.max.x, p.x);
+                c.stats.max.y = std::max(c.stats.max.y, p.y);
+                c.stats.max.z = std::max(c.stats.max.z, p.z);
+            }
+            c.stats.lines++;
+            line = cursor.end+1;
+        }
+        c.stats.points = c.points.size();
+        if (j.grid) {
+            j.grid->add(c.points.data(), c.points.size());
+            c.points.clear();
+        }
+    }
+
+    void bounds_task(uint64_t i, void * arg) {
+        job& j = *(job*)arg;
+        chunk& c = j.chunks[i];
+        text_bounds& b = c.bounds;
+        b.lines = 0;
+        b.points = 0;
+        for (int k=0; k<3; k++) {
+            b.min[k] = DBL_MAX;
+            b.max[k] = -DBL_MAX;
+        }
+        const char * line = c.begin;
+        while (line < c.end) {
+            const char * newline = (const char*)memchr(line, '\n', c.end-line);
+            text_cursor cursor = {line, newline ? newline : c.end};
+            double coord[3];
+            if (j.parse_coordinates(cursor, coord, j.arg)) {
+                b.points++;
+                for (int k=0; k<3; k++) {
+                    b.min[k] = std::min(b.min[k], coord[k]);
+                    b.max[k] = std::max(b.max[k], coord[k]);
+                }
+            }
+            b.lines++;
+            line = cursor.end+1;
+        }
+    }
+}
+
+/** Releases the memory of the given range, which has been parsed. */
+void textfile::release(uint64_t begin, uint64_t end) const {
+    begin &= ~(uint64_t)(sysconf(_SC_PAGESIZE)-1);
+    madvise((void*)(data+begin), end-begin, MADV_DONTNEED);
+}
+
+/**
+ * The chunks are parsed in batches of a few chunks per thread,
+ * after which their points are written in order and the memory of the batch is released.
+ */
+text_stats textfile::parse_points(uint64_t offset, int threads, line_parser parse, void * arg, pointfile& out, voxel_grid * grid) const {
+    text_stats total = {0, 0, point(~0u, ~0u, ~0u, 0), point(0, 0, 0, 0)};
+    job j;
+    j.data = data;
+    j.size = size;
+    j.parse = parse;
+    j.arg = arg;
+    j.grid = grid;
+    j.chunks.resize(threads*4);
+    while (offset < size) {
+        uint64_t batch_start = offset;
+        uint64_t n = j.split(offset);
+        parallel_for(threads, n, parse_task, &j);
+        for (uint64_t i=0; i<n; i++) {
+            const chunk& c = j.chunks[i];
+            for (uint64_t k=0; k<c.points.size(); k++) out.add(c.points[k]);
+            total.lines += c.stats.lines;
+            total.points += c.stats.points;
+            total.min.x = std::min(total.min.x, c.stats.min.x);
+            total.min.y = std::min(total.min.y, c.stats.min.y);
+            total.min.z = std::min(total.min.z, c.stats.min.z);
+            total.max.x = std::max(total.max.x, c.stats.max.x);
+            total.max.y = std::max(total.max.y, c.stats.max.y);
+            total.max.z = std::max(total.max.z, c.stats.max.z);
+        }
+        release(batch_start, offset);
+        fprintf(stderr, "parsed: %5luMiB of %luMiB, %luMi lines\n", offset>>20, size>>20, total.lines>>20);
+    }
+    return total;
+}
+
+text_bounds textfile::find_bounds(uint64_t offset, int threads, coordinate_parser parse, void * arg) const {
+    text_bounds total = {0, 0, {DBL_MAX, DBL_MAX, DBL_MAX}, {-DBL_MAX, -DBL_MAX, -DBL_MAX}};
+    job j;
+    j.data = data;
+    j.size = size;
+    j.parse_coordinates = parse;
+    j.arg = arg;
+    j.chunks.resize(threads*4);
+    while (offset < size) {
+        uint64_t batch_start = offset;
+        uint64_t n = j.split(offset);
+        parallel_for(threads, n, bounds_task, &j);
+        for (uint64_t i=0; i<n; i++) {
+            const text_bounds& b = j.chunks[i].bounds;
+            total.lines += b.lines;
+            total.points += b.points;
+            for (int k=0; k<3; k++) {
+                total.min[k] = std::min(total.min[k], b.min[k]);
+                total.max[k] = std::max(total.max[k], b.max[k]);
+            }
+        }
+        release(batch_start, offset);
+        fprintf(stderr, "scanned: %5luMiB of %luMiB, %luMi lines\n", offset>>20, size>>20, total.lines>>20);
+    }
+    return total;
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
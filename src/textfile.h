@@ -0,0 +1,100 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEXTFILE_H
+#define TEXTFILE_H
+#include <stdint.h>
+
+#include "pointset.h"
+
+struct voxel_grid;
+
+/**
+ * Reads the fields of a single line of text.
+ * Fields are separated by spaces, tabs or commas.
+ * Each read function skips the separators preceding the field and
+ * returns false if the field is missing or cannot be parsed.
+ */
+struct text_cursor {
+    const char * pos;
+    const char * end; /// End of the line, excluding the newline.
+    bool read_uint(uint32_t& value);
+    bool read_int(int64_t& value);
+    bool read_hex(uint32_t& value);
+    /** Reads a decimal number, like strtod, but without exponent. */
+    bool read_decimal(double& value);
+    /** Reads a decimal number multiplied by 10^decimals, truncating further decimals. */
+    bool read_fixed(int64_t& value, int decimals);
+    /** Skips a field. */
+    bool skip();
+};
+
+/**
+ * Parses a line into a point. Returns false if the line does not contain a point.
+ * Is called from multiple threads at the same time.
+ */
+typedef bool (*line_parser)(text_cursor& line, point& p, void * data);
+
+/**
+ * Parses the coordinates of a line. Returns false if the line does not contain a point.
+ * Is called from multiple threads at the same time.
+ */
+typedef bool (*coordinate_parser)(text_cursor& line, double coord[3], void * data);
+
+/** Statistics of the lines parsed by parse_points. */
+struct text_stats {
+    uint64_t lines;
+    uint64_t points;
+    point min, max; /// Bounds of the coordinates of the points.
+};
+
+/** Statistics of the lines parsed by find_bounds. */
+struct text_bounds {
+    uint64_t lines;
+    uint64_t points;
+    double min[3], max[3]; /// Bounds of the coordinates of the points.
+};
+
+/**
+ * Opens a text file for reading and maps it to memory.
+ */
+struct textfile {
+    int32_t fd;
+    uint64_t size;
+    const char * data;
+    textfile(const char * filename);
+    ~textfile();
+    /** Returns the offset of the line following the given number of lines. */
+    uint64_t skip_lines(uint64_t lines) const;
+    /**
+     * Parses the lines starting at the given offset into points, using the given number of threads.
+     * The file is split into chunks that end at a newline, which are parsed in parallel.
+     * The given argument is passed to the parser.
+     * The points are written to the output in the same order as the lines.
+     * If a grid is given, the points are added to the grid instead, which merges points with equal coordinates.
+     */
+    text_stats parse_points(uint64_t offset, int threads, line_parser parse, void * arg, pointfile& out, voxel_grid * grid=NULL) const;
+    /** Parses the coordinates of the lines starting at the given offset in parallel and returns their bounds. */
+    text_bounds find_bounds(uint64_t offset, int threads, coordinate_parser parse, void * arg) const;
+private:
+    void release(uint64_t begin, uint64_t end) const;
+    textfile(const textfile&);
+    textfile& operator=(const textfile&);
+};
+
+#endif
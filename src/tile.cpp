@@ -0,0 +1,157 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pointset.h"
+#include "morton.h"
+#include "timing.h"
+
+/* Splits a point set into tiles along the octree, such that each tile can be built 
+ * into an octree by build_db independently, for example on another machine.
+ * The resulting octree files can be combined into a single octree using stitch.
+ * 
+ * The tiles consist of consecutive nodes (in morton order) at a layer that is a few layers 
+ * below the root, chosen such that the tiles contain approximately the same number of points.
+ * The tiles are listed in a manifest, which is read by stitch.
+ */
+
+/** Number of layers below the root at which points are counted, depending on the number of tiles. */
+static int histogram_layers(int tiles) {
+  int k = 1;
+  while (k<7 && (1<<3*k) < tiles*8) k++;
+  return k;
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+  if (argc != 3) {
+    fprintf(stderr,"Please specify the file to split (without '.vxl') and the number of tiles.\n");
+    exit(2);
+  }
+  
+  // Determine the number of tiles.
+  char * endptr = NULL;
+  int tiles = strtol(argv[2], &endptr, 10);
+  if (endptr==argv[2] || endptr[0]!=0 || tiles<1 || tiles>4096) {
+    fprintf(stderr,"Could not parse number of tiles: '%s'.\n", argv[2]);
+    exit(1);
+  }
+  
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char infile[length+10];
+  char manifest[length+11];
+  sprintf(infile, "vxl/%s.vxl", name);
+  if (access(infile, F_OK)) sprintf(infile, "vxl/%s.vxlz", name);
+  sprintf(manifest, "vxl/%s.tiles", name);
+  
+  printf("[%10.0f] Opening '%s'.\n", t.elapsed(), infile);
+  pointset in(infile);
+  madvise(in.list, in.size, MADV_SEQUENTIAL);
+  
+  // Count the points per node at a few layers below the root. 
+  // As the root is not known in advance, the histogram is coarsened whenever the number of layers grows.
+  printf("[%10.0f] Counting %lu points per node.\n", t.elapsed(), in.length);
+  const int k = histogram_layers(tiles);
+  std::vector<uint64_t> histogram(1<<3*k);
+  int layers = 0;
+  int level = 0; // Layer at which the points are counted.
+  for (uint64_t i=0; i<in.length; i++) {
+    if (i && (i&0x3fffff)==0) printf("[%10.0f] Counting ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
+    const point& p = in.list[i];
+    uint64_t val = morton3d(p.z, p.y, p.x);
+    if (val>>layers*3) {
+      while (val>>layers*3) layers++;
+      int new_level = std::max(0, layers-k);
+      if (new_level != level) {
+        int shift = (new_level-level)*3;
+        for (uint64_t j=1; j<histogram.size(); j++) {
+          uint64_t count = histogram[j];
+          histogram[j] = 0;
+          histogram[j>>shift] += count;
+        }
+        level = new_level;
+      }
+    }
+    histogram[val>>level*3]++;
+  }
+  assert(layers>level);
+  printf("[%10.0f] Found %d data layers, splitting at layer %d.\n", t.elapsed(), layers, level);
+  
+  // Assign consecutive nodes to tiles, such that each tile gets about the same number of points.
+  std::vector<int> tile_of(histogram.size());
+  uint64_t sum = 0;
+  int used = 0;
+  int last = -1;
+  for (uint64_t j=0; j<histogram.size(); j++) {
+    int tile = in.length ? sum*tiles/in.length : 0;
+    if (histogram[j] && tile != last) {
+      last = tile;
+      used++;
+    }
+    tile_of[j] = used-1;
+    sum += histogram[j];
+  }
+  
+  // Distribute the points over the tiles.
+  printf("[%10.0f] Writing %d tiles.\n", t.elapsed(), used);
+  std::vector<pointfile*> out(used);
+  std::vector<uint64_t> bits(used);
+  std::vector<uint64_t> count(used);
+  for (int j=0; j<used; j++) {
+    char outfile[length+20];
+    sprintf(outfile, "vxl/%s-%d.vxl", name, j);
+    out[j] = new pointfile(outfile);
+  }
+  for (uint64_t i=0; i<in.length; i++) {
+    if (i && (i&0x3fffff)==0) printf("[%10.0f] Writing ... %6.2f%%.\n", t.elapsed(), i*100.0/in.length);
+    const point& p = in.list[i];
+    uint64_t val = morton3d(p.z, p.y, p.x);
+    int tile = tile_of[val>>level*3];
+    out[tile]->add(p);
+    bits[tile] |= val;
+    count[tile]++;
+  }
+  for (int j=0; j<used; j++) {
+    delete out[j];
+  }
+  
+  // Write the manifest, which contains the number of data layers of each tile.
+  FILE * f = fopen(manifest, "w");
+  if (!f) {perror("Could not create manifest"); exit(1);}
+  fprintf(f, "tiles %d layers %d level %d\n", used, layers, level);
+  for (int j=0; j<used; j++) {
+    int tile_layers = 0;
+    while (bits[j]>>tile_layers*3) tile_layers++;
+    fprintf(f, "%s-%d %d %lu\n", name, j, tile_layers, count[j]);
+    printf("[%10.0f] Tile %s-%d: %10lu points, %2d data layers.\n", t.elapsed(), name, j, count[j], tile_layers);
+  }
+  if (fclose(f)) {perror("Could not write manifest"); exit(1);}
+  printf("[%10.0f] Wrote manifest '%s'.\n", t.elapsed(), manifest);
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle; 
@@ -0,0 +1,192 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <queue>
+#include <pthread.h>
+
+#include "voxel_grid.h"
+#include "morton.h"
+#include "parallel.h"
+
+static const int SHARD_BITS = 8;
+static const uint32_t INITIAL_CAPACITY = 1<<10;
+static const uint32_t MAX_COUNT = 1<<24; /// Number of points after which the sums of a voxel are halved, to prevent overflow.
+
+/** A voxel in the hash table. Empty slots have n=0. */
+struct entry {
+    uint32_t x, y, z, n;
+    uint32_t r, g, b;
+};
+
+static inline uint64_t hash(uint32_t x, uint32_t y, uint32_t z) {
+    uint64_t h = x * 0x9E3779B97F4A7C15ull ^ y * 0xC2B2AE3D27D4EB4Full ^ z * 0x165667B19E3779F9ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+/** An open addressing hash table with linear probing, which grows when it becomes half full. */
+struct voxel_grid::shard {
+    pthread_mutex_t lock;
+    std::vector<entry> table;
+    uint64_t count; /// Number of voxels.
+    uint64_t points; /// Number of points.
+    shard() : table(INITIAL_CAPACITY), count(0), points(0) {
+        pthread_mutex_init(&lock, NULL);
+    }
+    ~shard() {
+        pthread_mutex_destroy(&lock);
+    }
+    void insert(const point& p, uint64_t h) {
+        uint64_t mask = table.size()-1;
+        uint64_t i = h & mask;
+        while (table[i].n && (table[i].x != p.x || table[i].y != p.y || table[i].z != p.z)) i = (i+1) & mask;
+        entry& e = table[i];
+        if (!e.n) {
+            e.x = p.x; e.y = p.y; e.z = p.z;
+            e.r = e.g = e.b = 0;
+            count++;
+        } else if (e.n == MAX_COUNT) {
+            e.r >>= 1; e.g >>= 1; e.b >>= 1; e.n >>= 1;
+        }
+        e.r += (p.c>>16)&0xff;
+        e.g += (p.c>>8)&0xff;
+        e.b += p.c&0xff;
+        e.n++;
+        points++;
+        if (count*2 > table.size()) grow();
+    }
+    void grow() {
+        std::vector<entry> old(table.size()*2);
+        old.swap(table);
+        uint64_t mask = table.size()-1;
+        for (uint64_t k=0; k<old.size(); k++) {
+            if (!old[k].n) continue;
+            uint64_t i = hash(old[k].x, old[k].y, old[k].z) & mask;
+            while (table[i].n) i = (i+1) & mask;
+            table[i] = old[k];
+        }
+    }
+};
+
+voxel_grid::voxel_grid() : shards(1<<SHARD_BITS) {
+    for (uint64_t i=0; i<shards.size(); i++) shards[i] = new shard();
+}
+
+voxel_grid::~voxel_grid() {
+    for (uint64_t i=0; i<shards.size(); i++) delete shards[i];
+}
+
+/**
+ * The points are grouped by shard first, such that each shard is locked only once.
+ * The highest bits of the hash select the shard, the lowest bits the slot.
+ */
+void voxel_grid::add(const point * list, uint64_t n) {
+    std::vector<uint64_t> hashes(n);
+    std::vector<uint32_t> start((1<<SHARD_BITS)+1);
+    for (uint64_t i=0; i<n; i++) {
+        hashes[i] = hash(list[i].x, list[i].y, list[i].z);
+        start[(hashes[i]>>(64-SHARD_BITS))+1]++;
+    }
+    for (int s=0; s<(1<<SHARD_BITS); s++) start[s+1] += start[s];
+    std::vector<uint32_t> order(n);
+    std::vector<uint32_t> pos(start.begin(), start.end()-1);
+    for (uint64_t i=0; i<n; i++) order[pos[hashes[i]>>(64-SHARD_BITS)]++] = i;
+    for (int s=0; s<(1<<SHARD_BITS); s++) {
+        if (start[s] == start[s+1]) continue;
+        shard& sh = *shards[s];
+        pthread_mutex_lock(&sh.lock);
+        for (uint32_t k=start[s]; k<start[s+1]; k++) sh.insert(list[order[k]], hashes[order[k]]);
+        pthread_mutex_unlock(&sh.lock);
+    }
+}
+
+uint64_t voxel_grid::points() const {
+    uint64_t n = 0;
+    for (uint64_t i=0; i<shards.size(); i++) n += shards[i]->points;
+    return n;
+}
+
+uint64_t voxel_grid::size() const {
+    uint64_t n = 0;
+    for (uint64_t i=0; i<shards.size(); i++) n += shards[i]->count;
+    return n;
+}
+
+namespace {
+    /** A voxel with its position along the hilbert curve. */
+    struct sorted_voxel {
+        uint64_t key;
+        point p;
+        bool operator<(const sorted_voxel& v) const {return key < v.key;}
+    };
+
+    struct sort_job {
+        std::vector<std::vector<entry>*> tables;
+        std::vector<std::vector<sorted_voxel> > runs;
+    };
+}
+
+/** Replaces the hash table of a shard by a list of its voxels, sorted along the hilbert curve. */
+static void sort_task(uint64_t i, void * data) {
+    sort_job& j = *(sort_job*)data;
+    std::vector<entry>& table = *j.tables[i];
+    std::vector<sorted_voxel>& run = j.runs[i];
+    for (uint64_t k=0; k<table.size(); k++) {
+        const entry& e = table[k];
+        if (!e.n) continue;
+        sorted_voxel v;
+        v.p = point(e.x, e.y, e.z, (e.r+e.n/2)/e.n<<16 | (e.g+e.n/2)/e.n<<8 | (e.b+e.n/2)/e.n);
+        v.key = hilbert3d(v.p);
+        run.push_back(v);
+    }
+    std::vector<entry>().swap(table);
+    std::sort(run.begin(), run.end());
+}
+
+/** The shards are sorted in parallel and then merged. */
+void voxel_grid::write(pointfile& out, int threads) {
+    sort_job j;
+    for (uint64_t i=0; i<shards.size(); i++) j.tables.push_back(&shards[i]->table);
+    j.runs.resize(shards.size());
+    parallel_for(threads, shards.size(), sort_task, &j);
+    typedef std::pair<uint64_t, uint32_t> head; // Key and run of the first remaining voxel of each run.
+    std::priority_queue<head, std::vector<head>, std::greater<head> > queue;
+    std::vector<uint64_t> next(j.runs.size());
+    for (uint32_t i=0; i<j.runs.size(); i++) {
+        if (!j.runs[i].empty()) queue.push(head(j.runs[i][0].key, i));
+    }
+    while (!queue.empty()) {
+        uint32_t i = queue.top().second;
+        queue.pop();
+        out.add(j.runs[i][next[i]].p);
+        if (++next[i] < j.runs[i].size()) {
+            queue.push(head(j.runs[i][next[i]].key, i));
+        } else {
+            std::vector<sorted_voxel>().swap(j.runs[i]);
+        }
+    }
+    for (uint64_t i=0; i<shards.size(); i++) {
+        delete shards[i];
+        shards[i] = new shard();
+    }
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
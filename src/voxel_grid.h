@@ -0,0 +1,54 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOXEL_GRID_H
+#define VOXEL_GRID_H
+#include <stdint.h>
+#include <vector>
+
+#include "pointset.h"
+
+/**
+ * Merges points with equal coordinates into a single point with their average color.
+ * Converters use it to decimate the input to the resolution of the output before writing it.
+ *
+ * Points can be added from multiple threads at the same time.
+ * The points are kept in a hash table, which is divided into shards that are locked separately.
+ */
+struct voxel_grid {
+    voxel_grid();
+    ~voxel_grid();
+    /** Adds the given points. Is thread safe. */
+    void add(const point * list, uint64_t n);
+    /** Returns the number of points that were added. */
+    uint64_t points() const;
+    /** Returns the number of distinct voxels. */
+    uint64_t size() const;
+    /**
+     * Writes the voxels to the output, sorted along the hilbert curve, and empties the grid.
+     * The shards are sorted using the given number of threads.
+     */
+    void write(pointfile& out, int threads);
+private:
+    struct shard;
+    std::vector<shard*> shards;
+    voxel_grid(const voxel_grid&);
+    voxel_grid& operator=(const voxel_grid&);
+};
+
+#endif
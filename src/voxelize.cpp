@@ -0,0 +1,536 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <SDL/SDL_image.h>
+#include <unistd.h>
+
+#include "pointset.h"
+#include "octree.h"
+#include "morton.h"
+#include "parallel.h"
+#include "timing.h"
+#include "options.h"
+
+/* Converts the triangles of a Wavefront OBJ file into voxels.
+ *
+ * The triangles are sampled at intervals of at most half a voxel.
+ * The voxels are divided into at most 16x16x16 bins, which are voxelized in parallel.
+ * Each bin contains the triangles that overlap it and only keeps the samples that fall inside it.
+ * The samples of a bin are sorted and merged into voxels with their average color.
+ * As the bins are aligned to the octree, the bins are written in the order of the space filling curve,
+ * such that the output is sorted as a whole.
+ *
+ * The pointset is sorted along the hilbert curve, such that build_db does not need to sort it.
+ * The octree is built directly from the voxels in Morton order.
+ */
+
+static const int DEFAULT_DEPTH = 11;
+static const int BIN_LEVELS = 4; /// Number of octree layers above the bins.
+
+SDL_PixelFormat fmt = {
+  NULL,
+  32,
+  4,
+  0,0,0,0,
+  16,8,0,24,
+  0xff0000, 0xff00, 0xff, 0xff000000,
+  0,
+  0
+};
+
+struct material {
+  uint32_t color;
+  SDL_Surface * texture;
+};
+
+/** A triangle, in the coordinates of the voxels. */
+struct triangle {
+  float pos[3][3];
+  float uv[3][2];
+  uint32_t color[3];
+  const SDL_Surface * texture; /// If not NULL, the color is taken from the texture.
+};
+
+/** The contents of an OBJ file, with the coordinates in the axis system of the engine. */
+struct mesh {
+  std::vector<float> vertices; /// x, y, z per vertex.
+  std::vector<uint32_t> colors; /// Color per vertex, if given.
+  std::vector<float> uvs; /// u, v per texture vertex.
+  std::vector<material> materials;
+  std::map<std::string, int> material_index;
+  struct corner {int v, t;};
+  struct face {corner c[3]; int material;};
+  std::vector<face> faces;
+};
+
+static uint32_t to_color(double r, double g, double b) {
+  int v[3] = {(int)(r*255+0.5), (int)(g*255+0.5), (int)(b*255+0.5)};
+  for (int i=0; i<3; i++) v[i] = std::max(0, std::min(255, v[i]));
+  return v[0]<<16 | v[1]<<8 | v[2];
+}
+
+/** Removes leading and trailing whitespace. */
+static char * trim(char * s) {
+  while (*s==' ' || *s=='\t') s++;
+  char * e = s + strlen(s);
+  while (e>s && (e[-1]=='\n' || e[-1]=='\r' || e[-1]==' ' || e[-1]=='\t')) e--;
+  *e = 0;
+  return s;
+}
+
+/** Returns the path of the given file, relative to the directory of the given file. */
+static std::string relative(const char * file, const char * name) {
+  const char * slash = strrchr(file, '/');
+  return std::string(file, slash ? slash+1-file : 0) + name;
+}
+
+/** Loads the materials of an MTL file. Only the diffuse color and texture are used. */
+static void load_materials(mesh& m, const char * filename) {
+  FILE * f = fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "Could not open material library '%s', using white.\n", filename);
+    return;
+  }
+  char * line = NULL;
+  size_t size = 0;
+  int current = -1;
+  while (getline(&line, &size, f) != -1) {
+    char * s = trim(line);
+    if (!strncmp(s, "newmtl ", 7)) {
+      material mat = {0xffffff, NULL};
+      current = m.materials.size();
+      m.material_index[trim(s+7)] = current;
+      m.materials.push_back(mat);
+    } else if (current >= 0 && !strncmp(s, "Kd ", 3)) {
+      double r=1, g=1, b=1;
+      sscanf(s+3, "%lf %lf %lf", &r, &g, &b);
+      m.materials[current].color = to_color(r, g, b);
+    } else if (current >= 0 && !strncmp(s, "map_Kd ", 7)) {
+      // Options precede the file name, which is assumed to contain no spaces.
+      const char * name = strrchr(s, ' ')+1;
+      std::string path = relative(filename, name);
+      SDL_Surface * image = IMG_Load(path.c_str());
+      if (!image) {
+        fprintf(stderr, "Could not load texture '%s', using its diffuse color.\n", path.c_str());
+        continue;
+      }
+      m.materials[current].texture = SDL_ConvertSurface(image, &fmt, SDL_SWSURFACE);
+      SDL_FreeSurface(image);
+    }
+  }
+  free(line);
+  fclose(f);
+}
+
+/** Parses a vertex reference of a face, which is given as 'v', 'v/t', 'v//n' or 'v/t/n'. */
+static bool parse_corner(char *& s, const mesh& m, mesh::corner& c) {
+  char * end;
+  long v = strtol(s, &end, 10);
+  if (end == s) return false;
+  long t = 0;
+  s = end;
+  if (*s == '/') {
+    s++;
+    t = strtol(s, &end, 10);
+    s = end;
+    if (*s == '/') {
+      s++;
+      strtol(s, &end, 10);
+      s = end;
+    }
+  }
+  // Indices start at 1 and negative indices are relative to the end.
+  long vertices = m.vertices.size()/3, uvs = m.uvs.size()/2;
+  c.v = v < 0 ? vertices + v : v - 1;
+  c.t = t < 0 ? uvs + t : t > 0 ? t - 1 : -1;
+  if (c.v < 0 || c.v >= vertices || c.t >= uvs) {
+    fprintf(stderr, "Face refers to a missing vertex.\n");
+    exit(1);
+  }
+  return true;
+}
+
+/**
+ * Loads the vertices and faces of an OBJ file. Polygons are split into triangle fans.
+ * Vertex colors may follow the coordinates as 'v x y z r g b'.
+ * The z-axis is flipped, as OBJ uses a right-handed axis system.
+ */
+static void load_mesh(mesh& m, const char * filename) {
+  FILE * f = fopen(filename, "r");
+  if (!f) {perror("Could not open file"); exit(1);}
+  char * line = NULL;
+  size_t size = 0;
+  int current = -1;
+  while (getline(&line, &size, f) != -1) {
+    char * s = trim(line);
+    if (!strncmp(s, "v ", 2)) {
+      double v[6];
+      int n = sscanf(s+2, "%lf %lf %lf %lf %lf %lf", v, v+1, v+2, v+3, v+4, v+5);
+      if (n < 3) continue;
+      m.vertices.push_back(v[0]);
+      m.vertices.push_back(v[1]);
+      m.vertices.push_back(-v[2]);
+      if (n == 6) {
+        m.colors.resize(m.vertices.size()/3-1, 0xffffff);
+        m.colors.push_back(to_color(v[3], v[4], v[5]));
+      }
+    } else if (!strncmp(s, "vt ", 3)) {
+      double u=0, v=0;
+      sscanf(s+3, "%lf %lf", &u, &v);
+      m.uvs.push_back(u);
+      m.uvs.push_back(v);
+    } else if (!strncmp(s, "f ", 2)) {
+      std::vector<mesh::corner> corners;
+      mesh::corner c;
+      char * p = s+2;
+      while (*p==' ' || *p=='\t') p++;
+      while (parse_corner(p, m, c)) {
+        corners.push_back(c);
+        while (*p==' ' || *p=='\t') p++;
+      }
+      for (size_t i=2; i<corners.size(); i++) {
+        mesh::face face = {{corners[0], corners[i-1], corners[i]}, current};
+        m.faces.push_back(face);
+      }
+    } else if (!strncmp(s, "usemtl ", 7)) {
+      std::map<std::string, int>::const_iterator it = m.material_index.find(trim(s+7));
+      current = it == m.material_index.end() ? -1 : it->second;
+    } else if (!strncmp(s, "mtllib ", 7)) {
+      load_materials(m, relative(filename, trim(s+7)).c_str());
+    }
+  }
+  free(line);
+  fclose(f);
+  if (!m.colors.empty()) m.colors.resize(m.vertices.size()/3, 0xffffff);
+}
+
+/** Returns the color of the texture at the given texture coordinates, which wrap around. */
+static uint32_t sample_texture(const SDL_Surface * s, float u, float v) {
+  int x = (int)floorf(u * s->w) % s->w;
+  int y = (int)floorf((1-v) * s->h) % s->h;
+  if (x<0) x += s->w;
+  if (y<0) y += s->h;
+  return ((const uint32_t*)s->pixels)[x + y*s->w] & 0xffffff;
+}
+
+/** Returns the interpolation of the given colors, with the given weights. */
+static uint32_t mix(const uint32_t c[3], float w0, float w1, float w2) {
+  uint32_t r = 0;
+  for (int shift=0; shift<24; shift+=8) {
+    float v = ((c[0]>>shift)&0xff)*w0 + ((c[1]>>shift)&0xff)*w1 + ((c[2]>>shift)&0xff)*w2;
+    r |= std::min(255, (int)(v+0.5f)) << shift;
+  }
+  return r;
+}
+
+/** A voxel, with its position along the space filling curve. */
+struct voxel {
+  uint64_t key;
+  point p;
+  bool operator<(const voxel& v) const {return key < v.key;}
+};
+
+struct job {
+  std::vector<triangle> triangles;
+  int depth;
+  int bin_bits; /// Size of a bin as power of 2.
+  bool morton; /// Whether the voxels are sorted in Morton order, instead of along the hilbert curve.
+  std::vector<std::vector<uint32_t> > bins; /// Triangles per bin, in order of the space filling curve.
+  std::vector<uint32_t> bin_position; /// Position of each bin in the grid of bins.
+  uint64_t first; /// First bin of the current batch.
+  std::vector<std::vector<voxel> > results;
+  uint64_t key(const point& p) const {
+    return morton ? morton3d(p.z, p.y, p.x) : hilbert3d(p);
+  }
+};
+
+/** Adds the samples of the triangle that fall in the given box, which is given in voxels, to the list. */
+static void sample_triangle(const job& j, const triangle& tri, const int lo[3], const int hi[3], std::vector<voxel>& out) {
+  const float * a = tri.pos[0];
+  float e1[3], e2[3], e3[3];
+  float len = 0;
+  for (int k=0; k<3; k++) {
+    e1[k] = tri.pos[1][k] - a[k];
+    e2[k] = tri.pos[2][k] - a[k];
+    e3[k] = tri.pos[2][k] - tri.pos[1][k];
+  }
+  for (int k=0; k<3; k++) len = std::max(len, std::max(std::fabs(e1[k]), std::max(std::fabs(e2[k]), std::fabs(e3[k]))));
+  // The samples are at most half a voxel apart along each axis.
+  int n = std::max(1, (int)ceilf(len*2));
+  float limit = (1<<j.depth) - 1;
+  for (int i=0; i<=n; i++) {
+    float s = (float)i/n;
+    float base[3], step[3];
+    // Determine the range of samples in this row that may fall in the box.
+    float jmin = 0, jmax = n-i;
+    for (int k=0; k<3; k++) {
+      base[k] = a[k] + e1[k]*s;
+      step[k] = e2[k]/n;
+      float from = lo[k]-0.5f - base[k];
+      float to = hi[k]-0.5f - base[k];
+      if (step[k] == 0) {
+        if (from > 0 || to < 0) jmax = -1;
+      } else {
+        float t0 = from/step[k], t1 = to/step[k];
+        if (t0 > t1) std::swap(t0, t1);
+        jmin = std::max(jmin, floorf(t0));
+        jmax = std::min(jmax, ceilf(t1));
+      }
+    }
+    for (int jj=(int)jmin; jj<=(int)jmax; jj++) {
+      voxel v;
+      uint32_t * c = &v.p.x;
+      bool inside = true;
+      for (int k=0; k<3; k++) {
+        float q = std::max(0.f, std::min(limit, base[k] + step[k]*jj));
+        c[k] = (uint32_t)(q + 0.5f);
+        inside &= (int)c[k] >= lo[k] && (int)c[k] < hi[k];
+      }
+      if (!inside) continue;
+      float t = (float)jj/n;
+      if (tri.texture) {
+        float u = tri.uv[0][0]*(1-s-t) + tri.uv[1][0]*s + tri.uv[2][0]*t;
+        float w = tri.uv[0][1]*(1-s-t) + tri.uv[1][1]*s + tri.uv[2][1]*t;
+        v.p.c = sample_texture(tri.texture, u, w);
+      } else {
+        v.p.c = mix(tri.color, 1-s-t, s, t);
+      }
+      v.key = j.key(v.p);
+      out.push_back(v);
+    }
+  }
+}
+
+static const int BINS_PER_AXIS = 1<<BIN_LEVELS;
+
+/** Returns the coordinates of the first voxel of the bin at the given position in the grid of bins. */
+static void bin_corner(uint32_t position, int bin_bits, int corner[3]) {
+  corner[0] = position / BINS_PER_AXIS / BINS_PER_AXIS << bin_bits;
+  corner[1] = position / BINS_PER_AXIS % BINS_PER_AXIS << bin_bits;
+  corner[2] = position % BINS_PER_AXIS << bin_bits;
+}
+
+/** Voxelizes the triangles of a bin, merging the samples in the same voxel. */
+static void bin_task(uint64_t i, void * data) {
+  job& j = *(job*)data;
+  uint64_t bin = j.first + i;
+  std::vector<voxel>& out = j.results[i];
+  out.clear();
+  int lo[3], hi[3];
+  bin_corner(j.bin_position[bin], j.bin_bits, lo);
+  for (int k=0; k<3; k++) hi[k] = lo[k] + (1<<j.bin_bits);
+  const std::vector<uint32_t>& list = j.bins[bin];
+  for (uint64_t k=0; k<list.size(); k++) {
+    sample_triangle(j, j.triangles[list[k]], lo, hi, out);
+  }
+  std::sort(out.begin(), out.end());
+  uint64_t n = 0;
+  for (uint64_t k=0; k<out.size();) {
+    color_sum sum;
+    uint64_t e = k;
+    for (; e<out.size() && out[e].key == out[k].key; e++) sum.add(out[e].p.c);
+    out[n] = out[k];
+    out[n].p.c = sum.average();
+    n++;
+    k = e;
+  }
+  out.resize(n);
+}
+
+/** Converts the faces into triangles in voxel coordinates and assigns them to the bins that they overlap. */
+static void prepare(job& j, const mesh& m, const quantization& q) {
+  std::vector<std::vector<uint32_t> > grid(BINS_PER_AXIS*BINS_PER_AXIS*BINS_PER_AXIS);
+  for (uint64_t i=0; i<m.faces.size(); i++) {
+    const mesh::face& f = m.faces[i];
+    const material * mat = f.material >= 0 ? &m.materials[f.material] : NULL;
+    triangle tri;
+    tri.texture = mat && mat->texture ? mat->texture : NULL;
+    int lo[3] = {INT32_MAX, INT32_MAX, INT32_MAX}, hi[3] = {0, 0, 0};
+    for (int c=0; c<3; c++) {
+      const mesh::corner& v = f.c[c];
+      for (int k=0; k<3; k++) {
+        tri.pos[c][k] = (m.vertices[v.v*3+k] - q.offset[k]) * q.scale;
+        int voxel = std::max(0, std::min((1<<j.depth)-1, (int)floorf(tri.pos[c][k] + 0.5f)));
+        lo[k] = std::min(lo[k], voxel);
+        hi[k] = std::max(hi[k], voxel);
+      }
+      tri.uv[c][0] = v.t >= 0 ? m.uvs[v.t*2] : 0;
+      tri.uv[c][1] = v.t >= 0 ? m.uvs[v.t*2+1] : 0;
+      tri.color[c] = !m.colors.empty() ? m.colors[v.v] : mat ? mat->color : 0xffffff;
+    }
+    if (tri.texture && (f.c[0].t < 0 || f.c[1].t < 0 || f.c[2].t < 0)) tri.texture = NULL;
+    uint32_t id = j.triangles.size();
+    j.triangles.push_back(tri);
+    for (int x = lo[0]>>j.bin_bits; x <= hi[0]>>j.bin_bits; x++) {
+      for (int y = lo[1]>>j.bin_bits; y <= hi[1]>>j.bin_bits; y++) {
+        for (int z = lo[2]>>j.bin_bits; z <= hi[2]>>j.bin_bits; z++) {
+          grid[(x*BINS_PER_AXIS + y)*BINS_PER_AXIS + z].push_back(id);
+        }
+      }
+    }
+  }
+
+  // Order the non-empty bins along the space filling curve.
+  std::vector<std::pair<uint64_t, uint32_t> > order;
+  for (uint32_t i=0; i<grid.size(); i++) {
+    if (grid[i].empty()) continue;
+    int c[3];
+    bin_corner(i, j.bin_bits, c);
+    order.push_back(std::make_pair(j.key(point(c[0], c[1], c[2], 0)), i));
+  }
+  std::sort(order.begin(), order.end());
+  for (uint64_t i=0; i<order.size(); i++) {
+    uint32_t b = order[i].second;
+    j.bins.push_back(std::vector<uint32_t>());
+    j.bins.back().swap(grid[b]);
+    j.bin_position.push_back(b);
+  }
+}
+
+static void usage() {
+  fprintf(stderr,"Please specify the file to convert (without '.obj').\n");
+  fprintf(stderr,"Usage: voxelize [-d depth] [-s scale] [-o | -c] [-j threads] file\n");
+  fprintf(stderr,"  -d depth   Number of bits per coordinate of the output (default: %d).\n", DEFAULT_DEPTH);
+  fprintf(stderr,"  -s scale   Number of voxels per unit of the input (default: fill the range of the output).\n");
+  fprintf(stderr,"  -o         Build the octree 'vxl/file.oct' directly, instead of writing a pointset.\n");
+  fprintf(stderr,"  -c         Write the points to standard output, instead of to 'vxl/file.vxl'.\n");
+  fprintf(stderr,"  -j threads Number of threads to use (default: all processors).\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  Timer t;
+
+  // Parse options
+  int depth = DEFAULT_DEPTH;
+  double scale = 0;
+  bool octree_output = false;
+  bool to_stdout = false;
+  int threads = processor_count();
+  int opt;
+  while ((opt = getopt(argc, argv, "d:s:ocj:")) != -1) {
+    switch (opt) {
+      case 'd':
+        depth = parse_int(optarg, "depth");
+        if (depth<1 || depth>MAX_DEPTH) {
+          fprintf(stderr, "Depth must be in the range [1,%d].\n", MAX_DEPTH);
+          exit(1);
+        }
+        break;
+      case 's':
+        scale = parse_double(optarg, "scale");
+        if (scale<=0) {
+          fprintf(stderr, "Scale must be positive.\n");
+          exit(1);
+        }
+        break;
+      case 'o': octree_output = true; break;
+      case 'c': to_stdout = true; break;
+      case 'j':
+        threads = parse_int(optarg, "number of threads");
+        if (threads<=0) threads = processor_count();
+        break;
+      default: usage();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  if (argc != 2 || (octree_output && to_stdout)) usage();
+
+  // Determine the file names.
+  char * name = argv[1];
+  int length=strlen(name);
+  char infile[length+11];
+  char outfile[length+9];
+  sprintf(infile, "input/%s.obj", name);
+  sprintf(outfile, octree_output ? "vxl/%s.oct" : "vxl/%s.vxl", name);
+
+  // Load the mesh.
+  IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
+  mesh m;
+  load_mesh(m, infile);
+  printf("[%10.0f] Loaded '%s' with %lu vertices, %lu triangles and %lu materials.\n", t.elapsed(), infile, m.vertices.size()/3, m.faces.size(), m.materials.size());
+  if (m.faces.empty()) {
+    fprintf(stderr, "No triangles found in '%s'.\n", infile);
+    exit(1);
+  }
+  double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+  double max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+  for (uint64_t i=0; i<m.vertices.size(); i++) {
+    min[i%3] = std::min(min[i%3], (double)m.vertices[i]);
+    max[i%3] = std::max(max[i%3], (double)m.vertices[i]);
+  }
+  quantization q;
+  q.fit(min, max, depth, scale);
+  printf("[%10.0f] Bounds: x %f - %f, y %f - %f, z %f - %f, using scale %f.\n", t.elapsed(), min[0], max[0], min[1], max[1], min[2], max[2], q.scale);
+
+  // Assign the triangles to bins.
+  job j;
+  j.depth = depth;
+  j.bin_bits = std::max(0, depth - BIN_LEVELS);
+  j.morton = octree_output;
+  prepare(j, m, q);
+  uint64_t bins = j.bins.size();
+  printf("[%10.0f] Voxelizing %lu bins of %d^3 voxels, using %d threads.\n", t.elapsed(), bins, 1<<j.bin_bits, threads);
+
+  // Voxelize the bins in batches of a few bins per thread, writing them in order.
+  pointfile * points = octree_output ? NULL : new pointfile(to_stdout ? "-" : outfile);
+  octree_builder * tree = octree_output ? new octree_builder(outfile) : NULL;
+  uint64_t voxels = 0;
+  for (j.first = 0; j.first < bins; j.first += j.results.size()) {
+    j.results.resize(std::min<uint64_t>(threads*2, bins - j.first));
+    parallel_for(threads, j.results.size(), bin_task, &j);
+    for (uint64_t i=0; i<j.results.size(); i++) {
+      const std::vector<voxel>& list = j.results[i];
+      for (uint64_t k=0; k<list.size(); k++) {
+        if (tree) {
+          tree->add(list[k].key, list[k].p.c);
+        } else {
+          points->add(list[k].p);
+        }
+      }
+      voxels += list.size();
+    }
+    printf("[%10.0f] Voxelized %lu of %lu bins, %lu voxels.\n", t.elapsed(), j.first + j.results.size(), bins, voxels);
+  }
+  if (tree) {
+    int layers = tree->finish();
+    printf("[%10.0f] Wrote %lu voxels in %d layers as %u nodes to '%s'.\n", t.elapsed(), voxels, layers, tree->out.nodes, outfile);
+    delete tree;
+  } else {
+    delete points;
+    q.write(outfile);
+    // The voxels were written along the hilbert curve, hence build_db need not check them.
+    if (!to_stdout) mark_sorted(outfile, true, voxels);
+    printf("[%10.0f] Wrote %lu voxels to '%s'.\n", t.elapsed(), voxels, outfile);
+  }
+  for (uint64_t i=0; i<m.materials.size(); i++) {
+    if (m.materials[i].texture) SDL_FreeSurface(m.materials[i].texture);
+  }
+}
+
+// kate: space-indent on; indent-width 2; mixedindent off; indent-mode cstyle;
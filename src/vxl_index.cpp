@@ -0,0 +1,151 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "vxl_index.h"
+#include "morton.h"
+
+/** Number of levels of the octree that are ordered by hilbert3d. */
+static const int CURVE_LEVELS = 20;
+
+/** A range [first, second) of hilbert keys. */
+typedef std::pair<uint64_t, uint64_t> key_range;
+
+void vxl_index::build(const pointset& in, uint32_t stride) {
+    this->points = in.length;
+    this->stride = stride;
+    keys.resize((in.length + stride - 1) / stride);
+    for (uint64_t i=0; i<keys.size(); i++) {
+        keys[i] = hilbert3d(in.list[i*stride]);
+    }
+}
+
+void vxl_index::write(const char * pointset) const {
+    char filename[strlen(pointset)+5];
+    sprintf(filename, "%s.idx", pointset);
+    FILE * f = fopen(filename, "wb");
+    if (!f) {perror("Could not create index file"); exit(1);}
+    vxl_index_header header = {VXL_INDEX_MAGIC, VXL_INDEX_VERSION, points, stride, 0};
+    if (fwrite(&header, sizeof(header), 1, f) != 1 || fwrite(keys.data(), sizeof(uint64_t), keys.size(), f) != keys.size()) {
+        perror("Could not write index file"); 
+        exit(1);
+    }
+    if (fclose(f)) {perror("Could not write index file"); exit(1);}
+}
+
+bool vxl_index::read(const char * pointset, uint64_t length) {
+    if (!is_sorted(pointset, length)) return false;
+    char filename[strlen(pointset)+5];
+    sprintf(filename, "%s.idx", pointset);
+    FILE * f = fopen(filename, "rb");
+    if (!f) return false;
+    vxl_index_header header;
+    bool valid = fread(&header, sizeof(header), 1, f) == 1 && header.magic == VXL_INDEX_MAGIC && 
+        header.version == VXL_INDEX_VERSION && header.points == length && header.stride > 0;
+    if (valid) {
+        points = header.points;
+        stride = header.stride;
+        keys.resize((points + stride - 1) / stride);
+        valid = fread(keys.data(), sizeof(uint64_t), keys.size(), f) == keys.size();
+    }
+    fclose(f);
+    return valid;
+}
+
+/** 
+ * Adds the key ranges of the aligned cubes that cover the box [min, max) to the list.
+ * Cubes that intersect the boundary of the box are subdivided down to the given bottom level.
+ */
+static void cover(const uint32_t min[3], const uint32_t max[3], const uint32_t corner[3], int level, int bottom, std::vector<key_range>& out) {
+    uint32_t size = 1u<<level;
+    bool inside = true;
+    for (int i=0; i<3; i++) {
+        if (corner[i] >= max[i] || corner[i] + size <= min[i]) return;
+        if (corner[i] < min[i] || corner[i] + size > max[i]) inside = false;
+    }
+    if (inside || level == bottom) {
+        uint64_t key = hilbert3d(point(corner[0], corner[1], corner[2], 0)) >> 3*level << 3*level;
+        out.push_back(key_range(key, key + (1ull<<3*level)));
+        return;
+    }
+    for (int k=0; k<8; k++) {
+        uint32_t child[3] = {corner[0] | (k&1)<<(level-1), corner[1] | (k>>1&1)<<(level-1), corner[2] | (k>>2&1)<<(level-1)};
+        cover(min, max, child, level-1, bottom, out);
+    }
+}
+
+/**
+ * The key only depends on the lower 20 bits of the coordinates, hence the box is wrapped into [0, 2^20) first.
+ * It is covered by cubes that are at most 128 times smaller than the box, 
+ * which limits the number of key ranges while keeping the overhead small.
+ */
+void vxl_index::find(const uint32_t min[3], const uint32_t max[3], std::vector<point_range>& ranges) const {
+    ranges.clear();
+    const uint64_t range = 1ull<<CURVE_LEVELS;
+    uint64_t extent = 0;
+    std::vector<std::pair<uint32_t, uint32_t> > parts[3];
+    for (int i=0; i<3; i++) {
+        if (min[i] >= max[i]) return;
+        uint64_t width = max[i] - min[i];
+        extent = std::max(extent, width);
+        uint64_t begin = min[i] & (range-1);
+        if (width >= range) {
+            parts[i].push_back(std::make_pair(0, range));
+        } else if (begin + width <= range) {
+            parts[i].push_back(std::make_pair(begin, begin + width));
+        } else {
+            parts[i].push_back(std::make_pair(begin, range));
+            parts[i].push_back(std::make_pair(0, begin + width - range));
+        }
+    }
+    int bottom = 0;
+    while (bottom < CURVE_LEVELS && (extent >> bottom) > 128) bottom++;
+    std::vector<key_range> key_ranges;
+    const uint32_t root[3] = {0, 0, 0};
+    for (uint32_t a=0; a<parts[0].size(); a++) {
+        for (uint32_t b=0; b<parts[1].size(); b++) {
+            for (uint32_t c=0; c<parts[2].size(); c++) {
+                uint32_t part_min[3] = {parts[0][a].first, parts[1][b].first, parts[2][c].first};
+                uint32_t part_max[3] = {parts[0][a].second, parts[1][b].second, parts[2][c].second};
+                cover(part_min, part_max, root, CURVE_LEVELS, bottom, key_ranges);
+            }
+        }
+    }
+    std::sort(key_ranges.begin(), key_ranges.end());
+    
+    // Find the points of each key range, merging ranges that overlap.
+    // A block that starts with a smaller key might still contain points of the key range.
+    for (uint64_t i=0; i<key_ranges.size(); i++) {
+        uint64_t first = std::lower_bound(keys.begin(), keys.end(), key_ranges[i].first) - keys.begin();
+        uint64_t last = std::lower_bound(keys.begin(), keys.end(), key_ranges[i].second) - keys.begin();
+        uint64_t begin = (first ? first - 1 : 0) * stride;
+        uint64_t end = std::min(last * stride, points);
+        if (begin >= end) continue;
+        if (!ranges.empty() && begin <= ranges.back().second) {
+            ranges.back().second = std::max(ranges.back().second, end);
+        } else {
+            ranges.push_back(point_range(begin, end));
+        }
+    }
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,73 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VXL_INDEX_H
+#define VXL_INDEX_H
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
+#include "pointset.h"
+
+/*
+ * The spatial index of a sorted pointset (.vxl.idx).
+ * 
+ * The file starts with a header, followed by the hilbert key of every stride-th point of the pointset.
+ * As the points are sorted along the hilbert curve, the points within an aligned cube of the octree
+ * form a range of keys, and hence a range of the pointset. This range is found by a binary search in the keys, 
+ * up to a precision of stride points. The index is small: 8 bytes per stride points.
+ * 
+ * The index is only valid while the pointset is marked as sorted, see is_sorted().
+ */
+
+static const uint32_t VXL_INDEX_MAGIC = 0x494c5856; /// "VXLI"
+static const uint32_t VXL_INDEX_VERSION = 1;
+static const uint32_t VXL_INDEX_STRIDE = 4096; /// Number of points per key, 128KiB of the pointset.
+
+struct vxl_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t points;
+    uint32_t stride;
+    uint32_t padding;
+};
+
+/** A range [first, second) of points in a pointset. */
+typedef std::pair<uint64_t, uint64_t> point_range;
+
+struct vxl_index {
+    uint64_t points; /// Number of points in the pointset.
+    uint32_t stride;
+    std::vector<uint64_t> keys;
+    /** Computes the index of the given pointset, which must be sorted. */
+    void build(const pointset& in, uint32_t stride=VXL_INDEX_STRIDE);
+    /** Writes the index next to the given pointset file. Exits if this fails. */
+    void write(const char * pointset) const;
+    /** 
+     * Reads the index of the given pointset file, containing the given number of points.
+     * Returns false if it does not exist or does not match the pointset.
+     */
+    bool read(const char * pointset, uint64_t length);
+    /**
+     * Lists the ranges of points that contain all points within the box [min, max), in the order of the pointset.
+     * The ranges may also contain points outside of the box.
+     */
+    void find(const uint32_t min[3], const uint32_t max[3], std::vector<point_range>& ranges) const;
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vxlz.h"
+#include "morton.h"
+
+bool is_vxlz(const char * filename) {
+    size_t length = strlen(filename);
+    return length >= 5 && !strcmp(filename + length - 5, ".vxlz");
+}
+
+/** The Morton key of a point, with x in the highest bit of each triple. */
+static inline uint64_t key(const point& p) {
+    return morton3d(p.z, p.y, p.x);
+}
+
+static inline void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(v | 0x80);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+static inline bool get_varint(const uint8_t *& pos, const uint8_t * end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos == end) return false;
+        uint8_t b = *pos++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) return true;
+    }
+    return false;
+}
+
+/**
+ * Writes v<<1 | flag as a 65 bit varint, such that the top bit of v is not lost.
+ * For values below 2^63 this is the same as put_varint(out, v<<1 | flag).
+ */
+static inline void put_varint_flag(std::vector<uint8_t>& out, uint64_t v, bool flag) {
+    uint8_t b = (v & 0x3f) << 1 | flag;
+    v >>= 6;
+    if (v) {
+        out.push_back(b | 0x80);
+        put_varint(out, v);
+    } else {
+        out.push_back(b);
+    }
+}
+
+/** Inverse of put_varint_flag. */
+static inline bool get_varint_flag(const uint8_t *& pos, const uint8_t * end, uint64_t& v, bool& flag) {
+    if (pos == end) return false;
+    uint8_t b = *pos++;
+    flag = b & 1;
+    v = (b >> 1) & 0x3f;
+    if (b < 0x80) return true;
+    uint64_t high;
+    if (!get_varint(pos, end, high) || high >> 58) return false;
+    v |= high << 6;
+    return true;
+}
+
+void vxlz_encode(const point * list, uint32_t n, std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(n*4);
+    uint64_t prev_key = 0;
+    uint32_t prev_color = 0;
+    for (uint32_t i=0; i<n; i++) {
+        const point& p = list[i];
+        if ((p.x | p.y | p.z) >> 21) {
+            fprintf(stderr, "Point (%u, %u, %u) does not fit in a compressed pointset.\n", p.x, p.y, p.z);
+            exit(1);
+        }
+        uint64_t k = key(p);
+        int64_t delta = k - prev_key;
+        uint64_t zigzag = (uint64_t)delta<<1 ^ (uint64_t)(delta>>63);
+        bool has_color = p.c != prev_color;
+        put_varint_flag(out, zigzag, has_color);
+        if (has_color) put_varint(out, p.c);
+        prev_key = k;
+        prev_color = p.c;
+    }
+}
+
+bool vxlz_decode(const uint8_t * data, uint32_t bytes, point * list, uint32_t n) {
+    const uint8_t * pos = data;
+    const uint8_t * end = data + bytes;
+    uint64_t k = 0;
+    uint64_t color = 0;
+    for (uint32_t i=0; i<n; i++) {
+        uint64_t zigzag;
+        bool has_color;
+        if (!get_varint_flag(pos, end, zigzag, has_color)) return false;
+        k += (zigzag>>1) ^ -(zigzag&1);
+        if (has_color && !get_varint(pos, end, color)) return false;
+        list[i].c = color;
+        morton3d_inverse(k, list[i].z, list[i].y, list[i].x);
+    }
+    return pos == end;
+}
+
+static void read_fully(int fd, void * data, uint64_t size, uint64_t offset) {
+    char * bytes = (char*)data;
+    while (size) {
+        ssize_t ret = pread(fd, bytes, size, offset);
+        if (ret < 0) {perror("Could not read compressed pointset"); exit(1);}
+        if (ret == 0) {fprintf(stderr, "Compressed pointset is truncated.\n"); exit(1);}
+        bytes += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+vxlz_reader::vxlz_reader(const char * filename) {
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {perror("Could not open file"); exit(1);}
+    uint64_t size = lseek(fd, 0, SEEK_END);
+    vxlz_header header;
+    vxlz_footer footer;
+    if (size < sizeof(header) + sizeof(footer)) {
+        fprintf(stderr, "'%s' is not a compressed pointset.\n", filename);
+        exit(1);
+    }
+    read_fully(fd, &header, sizeof(header), 0);
+    read_fully(fd, &footer, sizeof(footer), size - sizeof(footer));
+    if (header.magic != VXLZ_MAGIC || footer.magic != VXLZ_MAGIC) {
+        fprintf(stderr, "'%s' is not a compressed pointset.\n", filename);
+        exit(1);
+    }
+    if (header.version != VXLZ_VERSION || footer.version != VXLZ_VERSION) {
+        fprintf(stderr, "'%s' has unsupported version %u.\n", filename, header.version);
+        exit(1);
+    }
+    if (footer.index + footer.blocks * sizeof(vxlz_block) + sizeof(footer) != size) {
+        fprintf(stderr, "The index of '%s' is corrupt.\n", filename);
+        exit(1);
+    }
+    length = footer.points;
+    index.resize(footer.blocks);
+    if (footer.blocks)
+        read_fully(fd, &index[0], footer.blocks * sizeof(vxlz_block), footer.index);
+}
+
+vxlz_reader::~vxlz_reader() {
+    if (fd!=-1)
+        close(fd);
+}
+
+void vxlz_reader::read(uint64_t block, point * list) const {
+    const vxlz_block& b = index[block];
+    std::vector<uint8_t> data(b.bytes);
+    if (b.bytes)
+        read_fully(fd, &data[0], b.bytes, b.offset);
+    if (!vxlz_decode(data.empty() ? NULL : &data[0], b.bytes, list, b.points)) {
+        fprintf(stderr, "Block %lu of the compressed pointset is corrupt.\n", block);
+        exit(1);
+    }
+}
+
+// kate: space-indent on; indent-width 4; mixedindent off; indent-mode cstyle;
@@ -0,0 +1,86 @@
+/*
+    Voxel-Engine - A CPU based sparse octree renderer.
+    Copyright (C) 2013  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VXLZ_H
+#define VXLZ_H
+#include <stdint.h>
+#include <vector>
+
+#include "pointset.h"
+
+/*
+ * The compressed pointset format (.vxlz).
+ * 
+ * The file starts with a header, followed by blocks of points, an index of these blocks and a footer.
+ * Within a block, each point is stored as the difference between its Morton key and that of the previous point, 
+ * followed by its color if it differs from the color of the previous point. 
+ * Both are stored as varints. The difference is zigzag encoded and shifted up by one bit, with the lowest bit indicating
+ * whether the color follows. The result has 65 bits, hence its varint can take up to 10 bytes.
+ * Each block starts from key 0 and color 0, such that blocks can be decoded independently.
+ * The coordinates of the points must be less than 2^21.
+ */
+
+static const uint32_t VXLZ_MAGIC = 0x5a4c5856; /// "VXLZ"
+static const uint32_t VXLZ_VERSION = 1;
+
+struct vxlz_header {
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct vxlz_block {
+    uint64_t offset; /// Position of the block in the file.
+    uint32_t bytes;
+    uint32_t points;
+};
+
+struct vxlz_footer {
+    uint64_t points;
+    uint64_t blocks;
+    uint64_t index; /// Position of the index in the file.
+    uint32_t version;
+    uint32_t magic;
+};
+
+/** Returns whether the given file name has the '.vxlz' extension. */
+bool is_vxlz(const char * filename);
+
+/** Encodes the given points as a block, replacing the contents of out. Exits if a coordinate does not fit. */
+void vxlz_encode(const point * list, uint32_t n, std::vector<uint8_t>& out);
+
+/** Decodes a block into the given list, which must have room for n points. Returns false if the block is corrupt. */
+bool vxlz_decode(const uint8_t * data, uint32_t bytes, point * list, uint32_t n);
+
+/**
+ * Opens a compressed pointset for reading its blocks in any order.
+ * Exits if the file is not a valid compressed pointset.
+ */
+struct vxlz_reader {
+    int32_t fd;
+    uint64_t length; /// Number of points in the file.
+    std::vector<vxlz_block> index;
+    vxlz_reader(const char * filename);
+    ~vxlz_reader();
+    /** Decodes the given block into the given list, which must have room for its points. */
+    void read(uint64_t block, point * list) const;
+private:
+    vxlz_reader(const vxlz_reader&);
+    vxlz_reader& operator=(const vxlz_reader&);
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Helper of the octree tool checks in tools.sh.
+ *
+ *   leaves.check points file.vxl n seed [parity]
+ * Writes n pseudo random points in clusters to an unsorted pointset. If parity is given,
+ * the x coordinates are made even (0) or odd (1), such that two pointsets do not share voxels.
+ *
+ *   leaves.check dump file.oct
+ * Prints the leaves of an octree as 'x y z color', sorted, such that octrees with the same voxels
+ * but a different node order print the same.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "../src/pointset.h"
+#include "../src/octree.h"
+
+struct leaf {
+    uint32_t x, y, z;
+    int32_t color;
+    bool operator<(const leaf& o) const {
+        return x!=o.x ? x<o.x : y!=o.y ? y<o.y : z!=o.z ? z<o.z : color<o.color;
+    }
+};
+
+static void collect(const octree_file& in, uint64_t index, int depth, uint32_t x, uint32_t y, uint32_t z, std::vector<leaf>& out) {
+    octree64 n = in.node(index);
+    for (int i=0; i<8; i++) {
+        if (n.avgcolor[i]<0) continue;
+        uint32_t cx = x*2 + (i>>2&1);
+        uint32_t cy = y*2 + (i>>1&1);
+        uint32_t cz = z*2 + (i&1);
+        if (~n.child[i] && depth>1) {
+            collect(in, n.child[i], depth-1, cx, cy, cz, out);
+        } else {
+            leaf l = {cx<<(depth-1), cy<<(depth-1), cz<<(depth-1), n.avgcolor[i]};
+            out.push_back(l);
+        }
+    }
+}
+
+static int dump(const char * file) {
+    octree_file in(file);
+    uint64_t nodes = in.nodes();
+    int depth = in.wide ? octree_depth(in.root64, nodes) : octree_depth(in.root, nodes);
+    std::vector<leaf> list;
+    if (depth) collect(in, 0, depth, 0, 0, 0, list);
+    std::sort(list.begin(), list.end());
+    for (size_t i=0; i<list.size(); i++) {
+        printf("%u %u %u %06x\n", list[i].x, list[i].y, list[i].z, list[i].color);
+    }
+    return 0;
+}
+
+static int points(const char * file, uint64_t n, uint64_t seed, int parity) {
+    FILE * f = fopen(file, "wb");
+    if (!f) {perror("Could not create pointset"); return 1;}
+    uint64_t s = seed;
+    uint32_t center[16][3];
+    for (int c=0; c<16; c++) {
+        for (int j=0; j<3; j++) {
+            s = s * 6364136223846793005ull + 1442695040888963407ull;
+            center[c][j] = 64 + (s>>40) % 896;
+        }
+    }
+    for (uint64_t i=0; i<n; i++) {
+        s = s * 6364136223846793005ull + 1442695040888963407ull;
+        const uint32_t * c = center[s>>60];
+        point p(c[0] + (s>>8&63), c[1] + (s>>14&63), c[2] + (s>>20&63), s>>32 & 0xffffff);
+        if (parity>=0) p.x = (p.x&~1u) | parity;
+        if (fwrite(&p, sizeof(p), 1, f) != 1) {perror("Could not write pointset"); return 1;}
+    }
+    return fclose(f) != 0;
+}
+
+int main(int argc, char ** argv) {
+    if (argc == 3 && !strcmp(argv[1], "dump")) return dump(argv[2]);
+    if ((argc == 5 || argc == 6) && !strcmp(argv[1], "points")) {
+        return points(argv[2], strtoull(argv[3], NULL, 10), strtoull(argv[4], NULL, 10), argc == 6 ? atoi(argv[5]) : -1);
+    }
+    fprintf(stderr, "Usage: leaves.check points file.vxl n seed [parity] | leaves.check dump file.oct\n");
+    return 2;
+}
@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# Checks of the octree tools, run by 'make check' from the root of the repository.
+# Builds one generated pointset in each of the ways build_db supports and compares their leaves,
+# and checks that merge_oct and edit_db give the same leaves as building the result directly.
+# Exits with a non-zero status if a check fails.
+
+root=$(pwd)
+dir=$root/build/tools.check
+leaves=$root/build/leaves.check
+rm -rf "$dir"
+mkdir -p "$dir/vxl"
+cd "$dir" || exit 1
+failures=0
+
+fail() {
+  echo "tools: $1" >&2
+  failures=$((failures+1))
+}
+
+# Writes a fresh, unsorted copy of a generated pointset, such that each build sorts it again.
+points() {
+  rm -f vxl/$1.vxl vxl/$1.vxl.meta vxl/$1.vxl.idx vxl/$1.oct vxl/$1.oct.meta
+  "$leaves" points vxl/$1.vxl $2 $3 $4 || exit 1
+}
+
+# Runs a tool, keeping its output in log.
+run() {
+  "$root/$@" >> log 2>&1 || fail "'$*' failed"
+}
+
+# Compares the leaves of an octree to the expected ones and checks its structure.
+compare() {
+  "$leaves" dump vxl/$1.oct > $1.leaves || exit 1
+  cmp -s $2 $1.leaves || fail "$3 differs from the expected leaves"
+  "$root/octcheck" vxl/$1.oct > check.log 2>&1 || fail "octcheck reports errors in $3"
+}
+
+# Like compare, for octrees that are built from scratch, which contain only reachable nodes.
+compare_built() {
+  compare "$@"
+  grep -q "(0 unreachable)" check.log || fail "$3 contains unreachable nodes"
+}
+
+# Build the same points layer by layer, streaming, in parallel and as stitched tiles.
+points p 200000 1
+run build_db -b 1 p
+"$leaves" dump vxl/p.oct > expected.leaves || exit 1
+test -s expected.leaves || fail "the layered build has no leaves"
+points p 200000 1
+run build_db -s -b 1 p
+compare_built p expected.leaves "build_db -s"
+points p 200000 1
+run build_db -j 3 -b 1 p
+compare_built p expected.leaves "build_db -j 3"
+points p 200000 1
+run tile p 4
+for tile in $(tail -n +2 vxl/p.tiles | cut -d' ' -f1); do
+  run build_db -s -b 1 $tile
+done
+run stitch p
+compare_built p expected.leaves "tile and stitch"
+
+# Two pointsets that do not share voxels, and their union.
+points a 50000 2 0
+points b 50000 3 1
+cat vxl/a.vxl vxl/b.vxl > vxl/u.vxl
+run build_db -b 0 a
+run build_db -b 0 b
+run build_db -b 0 u
+"$leaves" dump vxl/a.oct > a.expected || exit 1
+"$leaves" dump vxl/u.oct > u.expected || exit 1
+
+# Merging b into a gives the union.
+cp vxl/a.oct vxl/m.oct
+cp vxl/a.oct.meta vxl/m.oct.meta
+run merge_oct m b
+compare m u.expected "merge_oct"
+
+# Removing b from the union gives a, inserting it again gives the union.
+run edit_db -d vxl/b.vxl u
+compare u a.expected "edit_db -d"
+run edit_db -a vxl/b.vxl u
+compare u u.expected "edit_db -a"
+"$root/edit_db" -b 2 -d vxl/b.vxl u >> log 2>&1 && fail "edit_db accepts a -b that differs from build_db"
+
+if [ $failures -ne 0 ]; then
+  echo "tools: $failures checks failed, see '$dir/log'." >&2
+  exit 1
+fi
+echo "tools: all checks passed."
@@ -0,0 +1,61 @@
+/*
+ * Round-trip check of the compressed pointset encoding.
+ * Exits with a non-zero status if a block does not decode to the points it was encoded from.
+ */
+#include <cstdio>
+#include <vector>
+
+#include "../src/vxlz.h"
+
+static int check(const char * name, const std::vector<point>& list) {
+    std::vector<uint8_t> data;
+    vxlz_encode(&list[0], list.size(), data);
+    std::vector<point> out(list.size());
+    if (!vxlz_decode(&data[0], data.size(), &out[0], out.size())) {
+        fprintf(stderr, "%s: block does not decode.\n", name);
+        return 1;
+    }
+    for (size_t i=0; i<list.size(); i++) {
+        const point& a = list[i];
+        const point& b = out[i];
+        if (a.x!=b.x || a.y!=b.y || a.z!=b.z || a.c!=b.c) {
+            fprintf(stderr, "%s: point %lu (%u, %u, %u, %x) decodes as (%u, %u, %u, %x).\n",
+                name, i, a.x, a.y, a.z, a.c, b.x, b.y, b.z, b.c);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main() {
+    int failures = 0;
+    const uint32_t max = (1u<<21) - 1;
+    std::vector<point> list;
+    
+    // Keys that differ by at least 2^62, which need all 65 bits of the flagged delta.
+    list.push_back(point(1u<<20, 0, 0, 0));
+    list.push_back(point(0, 0, 0, 0));
+    list.push_back(point(max, max, max, 0xffffff));
+    list.push_back(point(1u<<20, 5, 7, 0xffffff));
+    list.push_back(point(0, max, 0, 1));
+    list.push_back(point(max, 0, max, 1));
+    failures += check("large deltas", list);
+    
+    // Small steps, with and without color changes.
+    list.clear();
+    for (uint32_t i=0; i<1000; i++)
+        list.push_back(point((1u<<20) + i%10, i/10%10, i/100, i/3));
+    failures += check("small deltas", list);
+    
+    // Pseudo random points across the whole range.
+    list.clear();
+    uint64_t s = 1;
+    for (uint32_t i=0; i<100000; i++) {
+        s = s * 6364136223846793005ull + 1442695040888963407ull;
+        list.push_back(point(s>>43 & max, s>>22 & max, s>>1 & max, s>>40));
+    }
+    failures += check("random", list);
+    
+    if (!failures) printf("vxlz: all round trips passed.\n");
+    return failures != 0;
+}